@@ -0,0 +1,80 @@
+/*
+ * alloc.c - The registry of allocator engines
+ *
+ *     mm     the mm.c package on the simulated heap in memlib.c
+ *     libc   the C library's malloc, which has no heap we can see, so
+ *            its utilization is not measured
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "mm.h"
+#include "memlib.h"
+
+/*
+ * mm_stats - The simulated heap and the cost of searching it, and with
+ *     walk, its free blocks
+ */
+static void mm_stats(alloc_stats_t *st, int walk)
+{
+    mm_heap_stats_t hs;
+
+    memset(st, 0, sizeof(*st));
+    st->heap_lo = mem_heap_lo();
+    st->heap_hi = mem_heap_hi();
+    st->heap_size = mem_heapsize();
+    st->heap_max = mem_heap_maxsize();
+    mm_search_stats(&st->search);
+    if (walk) {
+	mm_heap_stats(&hs);
+	st->free_bytes = hs.free_bytes;
+	st->largest_free = hs.largest_free;
+	st->free_blocks = hs.free_blocks;
+    }
+}
+
+/*
+ * libc_init, libc_stats - libc malloc needs no setup and shows us
+ *     nothing, so there is no heap for walk to count
+ */
+static int libc_init(void)
+{
+    return 0;
+}
+
+static void libc_stats(alloc_stats_t *st, int walk)
+{
+    (void)walk;
+    memset(st, 0, sizeof(*st));
+}
+
+static allocator_t engines[] = {
+    { "mm", "mm malloc", 0, 1, mem_reset_brk, mm_init, mm_malloc, mm_free,
+      NULL, mm_stats },
+    { "libc", "libc malloc", 1, 0, NULL, libc_init, malloc, free,
+      realloc, libc_stats },
+};
+
+#define NUM_ENGINES (sizeof(engines) / sizeof(engines[0]))
+
+/*
+ * alloc_find - Look an engine up by name
+ */
+allocator_t *alloc_find(char *name)
+{
+    size_t i;
+
+    for (i = 0; i < NUM_ENGINES; i++)
+	if (!strcmp(engines[i].name, name))
+	    return &engines[i];
+    return NULL;
+}
+
+/*
+ * alloc_get - The i-th registered engine
+ */
+allocator_t *alloc_get(int i)
+{
+    return (i >= 0 && (size_t)i < NUM_ENGINES) ? &engines[i] : NULL;
+}
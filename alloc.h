@@ -0,0 +1,52 @@
+#ifndef __ALLOC_H_
+#define __ALLOC_H_
+
+/*
+ * alloc.h - One interface to every allocator the driver can evaluate
+ *
+ * Each engine is a table of functions, registered by name in alloc.c.
+ * The driver's replay loops only ever call through the table, so an
+ * allocator variant is added by writing its functions and one entry in
+ * the registry, and is picked at run time with -a. An engine without a
+ * reset function has its blocks freed one at a time instead.
+ */
+#include <stddef.h>
+#include "mm.h"
+
+/* What an engine can tell about its heap */
+typedef struct {
+    char *heap_lo;       /* payloads lie in [heap_lo, heap_hi], or both */
+    char *heap_hi;       /*   NULL if the engine has no single heap */
+    size_t heap_size;    /* bytes the heap has grown to */
+    size_t heap_max;     /* bytes the heap can grow to */
+
+    /* filled in only when the stats function is asked to walk the heap */
+    size_t free_bytes;   /* bytes in free blocks */
+    size_t largest_free; /* size of the largest free block */
+    size_t free_blocks;  /* number of free blocks */
+
+    /* the cost of mm.c's searches and coalesces since init; all zero for
+       engines that are not mm.c */
+    mm_search_t search;
+} alloc_stats_t;
+
+typedef struct {
+    char *name;                               /* as given to -a */
+    char *desc;                               /* for table headings */
+    int thread_safe;                          /* may threads share it? */
+    int heap;                                 /* does stats see its heap? */
+    void (*reset)(void);                      /* drop every block, or NULL */
+    int (*init)(void);                        /* start over; -1 on error */
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size); /* NULL if not supported */
+    void (*stats)(alloc_stats_t *st, int walk); /* walk: count free blocks */
+} allocator_t;
+
+/* The engine registered under name, or NULL */
+allocator_t *alloc_find(char *name);
+
+/* The i-th registered engine, or NULL past the last one */
+allocator_t *alloc_get(int i);
+
+#endif /* __ALLOC_H_ */
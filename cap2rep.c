@@ -0,0 +1,335 @@
+/*
+ * cap2rep.c - Turn a log written by the capture library into a trace
+ *
+ * usage: cap2rep [-t] [-r] <logfile> <outfile>
+ *
+ * The records are sorted back into the order the program made its
+ * requests, and each block gets a dense id, in order of allocation, by
+ * following its address from malloc to free. The output is a binary
+ * trace, or text with -t, with a thread number on each request. Since
+ * the driver does not replay realloc, each realloc becomes a free and
+ * an allocation of the same id unless -r is given. Allocations of 0
+ * bytes are made 1 byte, which every allocator must provide.
+ *
+ * Requests the log can't account for are dropped and counted: frees of
+ * blocks allocated before capture began, and allocations at an address
+ * that was never freed (whose old block is then freed first).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "capture.h"
+#include "trace.h"
+
+#define EMPTY 0  /* ptrmap keys that no block can have */
+#define GONE  1
+
+int verbose = 0;        /* read by trace.c */
+
+/* Open-addressing map from live block addresses to their ids */
+typedef struct {
+    uint64_t *key;
+    int *id;
+    size_t cap;         /* slots, a power of two */
+    size_t used;        /* slots that are not EMPTY */
+} ptrmap_t;
+
+/* What cap2rep had to leave out */
+typedef struct {
+    uint64_t missing;   /* sequence numbers with no record */
+    uint64_t unknown;   /* frees and reallocs of blocks we never saw */
+    uint64_t reused;    /* allocations at a live address */
+    uint64_t zero;      /* 0-byte allocations made 1 byte */
+    uint64_t leaked;    /* blocks never freed */
+} drops_t;
+
+static void cap_error(char *msg)
+{
+    fprintf(stderr, "cap2rep: %s\n", msg);
+    exit(1);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: cap2rep [-t] [-r] <logfile> <outfile>\n");
+    fprintf(stderr, "\t-t   Write the text .rep format instead of binary.\n");
+    fprintf(stderr, "\t-r   Keep reallocs rather than splitting them into free and alloc.\n");
+}
+
+/*
+ * slot - The slot holding key, or the first free slot on its probe
+ *     sequence if it is not in the map
+ */
+static size_t slot(ptrmap_t *m, uint64_t key, int insert)
+{
+    size_t i = (size_t)(((key >> 4) * 0x9E3779B97F4A7C15ULL) >> 20) & (m->cap - 1);
+    size_t gone = (size_t)-1;
+
+    for (;; i = (i + 1) & (m->cap - 1)) {
+	if (m->key[i] == key)
+	    return i;
+	if (m->key[i] == GONE && gone == (size_t)-1)
+	    gone = i;
+	if (m->key[i] == EMPTY)
+	    return insert && gone != (size_t)-1 ? gone : i;
+    }
+}
+
+static void map_init(ptrmap_t *m, size_t cap)
+{
+    m->cap = cap;
+    m->used = 0;
+    m->key = (uint64_t *)calloc(cap, sizeof(uint64_t));
+    m->id = (int *)malloc(cap * sizeof(int));
+    if (m->key == NULL || m->id == NULL)
+	cap_error("out of memory for the address map");
+}
+
+/*
+ * map_put - Make key map to id, growing the map (and dropping the GONE
+ *     slots) once it is half full
+ */
+static void map_put(ptrmap_t *m, uint64_t key, int id)
+{
+    ptrmap_t old;
+    size_t i;
+
+    if (2 * (m->used + 1) > m->cap) {
+	old = *m;
+	map_init(m, old.cap * 2);
+	for (i = 0; i < old.cap; i++)
+	    if (old.key[i] > GONE)
+		map_put(m, old.key[i], old.id[i]);
+	free(old.key);
+	free(old.id);
+    }
+    i = slot(m, key, 1);
+    if (m->key[i] == EMPTY)
+	m->used++;
+    m->key[i] = key;
+    m->id[i] = id;
+}
+
+/*
+ * map_take - Remove key from the map; returns its id, or -1
+ */
+static int map_take(ptrmap_t *m, uint64_t key)
+{
+    size_t i = slot(m, key, 0);
+
+    if (m->key[i] != key)
+	return -1;
+    m->key[i] = GONE;
+    return m->id[i];
+}
+
+static int cmp_seq(const void *a, const void *b)
+{
+    uint64_t x = ((const capture_rec_t *)a)->seq;
+    uint64_t y = ((const capture_rec_t *)b)->seq;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * read_log - Read a log's header and all of its records, sorted by
+ *     sequence number; returns how many records there were
+ */
+static size_t read_log(char *path, capture_hdr_t *hdr, capture_rec_t **recs)
+{
+    struct stat st;
+    size_t n;
+    FILE *fp;
+
+    if ((fp = fopen(path, "rb")) == NULL || fstat(fileno(fp), &st) < 0) {
+	perror(path);
+	exit(1);
+    }
+    if (fread(hdr, sizeof(*hdr), 1, fp) != 1)
+	cap_error("log is too short for its header");
+    if (memcmp(hdr->magic, CAPTURE_MAGIC, sizeof(hdr->magic)) != 0)
+	fprintf(stderr, "cap2rep: %s has no header; the program may not "
+		"have exited normally\n", path);
+    n = (st.st_size - sizeof(*hdr)) / sizeof(capture_rec_t);
+    if ((*recs = (capture_rec_t *)malloc((n ? n : 1) * sizeof(capture_rec_t))) == NULL)
+	cap_error("out of memory for the log");
+    if (fread(*recs, sizeof(capture_rec_t), n, fp) != n)
+	cap_error("could not read the log");
+    fclose(fp);
+    qsort(*recs, n, sizeof(capture_rec_t), cmp_seq);
+    return n;
+}
+
+/*
+ * convert - Turn the sorted records into trace ops; returns how many
+ *     ops there are in *ops and how many ids in *num_ids
+ */
+static int convert(capture_rec_t *recs, size_t n, int keep_realloc,
+		   traceop_t **ops, int *num_ids, drops_t *d)
+{
+    ptrmap_t map;
+    traceop_t *o;
+    capture_rec_t *r;
+    int *pending = NULL;   /* each thread's block being reallocated */
+    int npending = 0, ids = 0, id, t, nops = 0;
+    size_t i;
+
+    map_init(&map, 1024);
+    if ((o = (traceop_t *)malloc((3 * n + 1) * sizeof(traceop_t))) == NULL)
+	cap_error("out of memory for the ops");
+    memset(d, 0, sizeof(*d));
+
+#define EMIT(ty, i_, sz) \
+    do { o[nops].type = (ty); o[nops].index = (i_); o[nops].size = (sz); \
+	 o[nops].thread = r->thread; nops++; } while (0)
+
+    for (i = 0; i < n; i++) {
+	r = &recs[i];
+	if ((int)r->thread >= npending) {
+	    t = npending;
+	    npending = r->thread + 1;
+	    if ((pending = (int *)realloc(pending, npending * sizeof(int))) == NULL)
+		cap_error("out of memory for the threads");
+	    for (; t < npending; t++)
+		pending[t] = -1;
+	}
+
+	switch (r->type) {
+	case CAP_ALLOC:
+	    if ((id = map_take(&map, r->ptr)) >= 0) {
+		d->reused++;
+		EMIT(FREE, id, 0);
+	    }
+	    if (r->size == 0)
+		d->zero++;
+	    map_put(&map, r->ptr, ids);
+	    EMIT(ALLOC, ids, r->size ? r->size : 1);
+	    ids++;
+	    break;
+
+	case CAP_FREE:
+	    if ((id = map_take(&map, r->ptr)) < 0)
+		d->unknown++;
+	    else
+		EMIT(FREE, id, 0);
+	    break;
+
+	case CAP_REALLOC0:
+	    if ((pending[r->thread] = map_take(&map, r->ptr)) < 0)
+		d->unknown++;
+	    break;
+
+	case CAP_REALLOC1:
+	    if ((id = pending[r->thread]) < 0)
+		break;
+	    pending[r->thread] = -1;
+	    if ((t = map_take(&map, r->ptr)) >= 0) {
+		d->reused++;
+		EMIT(FREE, t, 0);
+	    }
+	    map_put(&map, r->ptr, id);
+	    if (r->size == 0)      /* realloc failed; the old block stays */
+		break;
+	    if (keep_realloc)
+		EMIT(REALLOC, id, r->size);
+	    else {
+		EMIT(FREE, id, 0);
+		EMIT(ALLOC, id, r->size);
+	    }
+	    break;
+
+	default:
+	    cap_error("log has a record of unknown type");
+	}
+    }
+#undef EMIT
+
+    for (i = 0; i < map.cap; i++)
+	if (map.key[i] > GONE)
+	    d->leaked++;
+    free(map.key);
+    free(map.id);
+    free(pending);
+    *ops = o;
+    *num_ids = ids;
+    return nops;
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, nops, num_ids, threads = 0;
+    int format = TRACE_BINARY, keep_realloc = 0;
+    capture_hdr_t hdr;
+    capture_rec_t *recs;
+    traceop_t *ops;
+    trace_hdr_t th;
+    trace_writer_t *w;
+    drops_t d;
+    size_t n;
+    uint64_t total;
+
+    while ((c = getopt(argc, argv, "trh")) != EOF) {
+	switch (c) {
+	case 't':
+	    format = TRACE_TEXT;
+	    break;
+	case 'r':
+	    keep_realloc = 1;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (argc - optind != 2) {
+	usage();
+	exit(1);
+    }
+
+    n = read_log(argv[optind], &hdr, &recs);
+    nops = convert(recs, n, keep_realloc, &ops, &num_ids, &d);
+    total = n ? recs[n-1].seq + 1 : 0;
+    if (hdr.num_ops > total)
+	total = hdr.num_ops;
+    d.missing = total - n;
+    free(recs);
+
+    th.sugg_heapsize = 0;
+    th.num_ids = num_ids;
+    th.num_ops = nops;
+    th.weight = 1;
+    w = trace_create(argv[optind+1], &th, format);
+    for (i = 0; i < nops; i++) {
+	trace_write(w, &ops[i]);
+	if (ops[i].thread >= threads)
+	    threads = ops[i].thread + 1;
+    }
+    trace_finish(w);
+    free(ops);
+
+    printf("%lu records -> %d ops on %d ids, %d thread%s\n", (unsigned long)n,
+	   nops, num_ids, threads, threads == 1 ? "" : "s");
+    if (hdr.num_ids != 0 && hdr.num_ids != (uint64_t)num_ids)
+	printf("  (the program made %lu allocations)\n",
+	       (unsigned long)hdr.num_ids);
+    if (d.missing)
+	printf("  %lu requests missing from the log\n", (unsigned long)d.missing);
+    if (d.unknown)
+	printf("  %lu frees of blocks allocated before capture, dropped\n",
+	       (unsigned long)d.unknown);
+    if (d.reused)
+	printf("  %lu allocations at a live address; the old block was freed\n",
+	       (unsigned long)d.reused);
+    if (d.zero)
+	printf("  %lu 0-byte allocations made 1 byte\n", (unsigned long)d.zero);
+    if (d.leaked)
+	printf("  %lu blocks never freed\n", (unsigned long)d.leaked);
+    exit(0);
+}
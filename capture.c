@@ -0,0 +1,306 @@
+/*
+ * capture.c - Record a program's allocations, to replay as a trace
+ *
+ * Built as libcapture.so and preloaded into an unmodified program:
+ *
+ *     LD_PRELOAD=./libcapture.so CAPTURE_FILE=svc.cap ./svc
+ *     cap2rep svc.cap svc.bin
+ *
+ * malloc, calloc, realloc, free, memalign, posix_memalign and
+ * aligned_alloc are interposed and passed on to glibc's own entry
+ * points (__libc_malloc and friends), so no dlsym lookup is needed and
+ * nothing here allocates through the functions it wraps. Each thread
+ * appends records to a buffer of its own, taking a sequence number
+ * from one atomic counter, and writes the whole buffer to the log when
+ * it fills. The log is opened with O_APPEND, so those writes never
+ * interleave and no lock is taken anywhere. Buffers are flushed when
+ * their thread exits (a request made later in its teardown claims a
+ * buffer afresh) and when the program exits, for the exiting thread
+ * and for every buffer no thread holds. A buffer still held by a running thread is left
+ * alone then, so that thread loses the requests it has not flushed.
+ *
+ * Pointers are kept as they are: cap2rep, which reads the log back in
+ * sequence order, maps each live address to a dense block id.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "capture.h"
+
+/* glibc's allocator, under the names it exports for wrappers like us */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_memalign(size_t align, size_t size);
+
+/* Thread-local storage that never allocates */
+#define TLS __thread __attribute__((tls_model("initial-exec")))
+
+/* One thread's records, awaiting a write to the log */
+typedef struct capbuf {
+    struct capbuf *next;   /* every buffer ever made, for the final flush */
+    int owned;             /* in use by a live thread? */
+    int n;                 /* records in rec */
+    capture_rec_t rec[CAPTURE_BUF];
+} capbuf_t;
+
+static int log_fd = -1;          /* the log, or -1 while not capturing */
+static char log_path[4096];
+static int capturing = 0;        /* set once the log is open */
+static uint64_t next_seq = 0;    /* sequence number of the next record */
+static uint64_t num_ids = 0;     /* blocks allocated */
+static uint32_t num_threads = 0; /* threads that have made requests */
+static capbuf_t *buffers = NULL; /* list of every buffer */
+static pthread_key_t exit_key;   /* flushes a thread's buffer as it exits */
+
+static TLS capbuf_t *my_buf;     /* this thread's buffer */
+static TLS int my_thread = -1;   /* this thread's number */
+static TLS int busy;             /* set while we are recording */
+
+/*
+ * flush - Write out a buffer's records
+ */
+static void flush(capbuf_t *b)
+{
+    char *p = (char *)b->rec;
+    size_t len = b->n * sizeof(capture_rec_t);
+    ssize_t n;
+
+    while (len > 0) {
+	if ((n = write(log_fd, p, len)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+	p += n;
+	len -= n;
+    }
+    b->n = 0;
+}
+
+/*
+ * thread_exit - Flush a thread's buffer and leave it for another thread.
+ *     The thread lets go of it first: a free made later in its teardown,
+ *     by another key's destructor, must not go into a buffer another
+ *     thread may have taken, so it claims one through get_buf, which
+ *     sets the key again and brings us back for another round.
+ */
+static void thread_exit(void *arg)
+{
+    capbuf_t *b = (capbuf_t *)arg;
+
+    my_buf = NULL;
+    if (capturing)
+	flush(b);
+    __atomic_store_n(&b->owned, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * get_buf - This thread's buffer: a free one from the list, or a new
+ *     one mapped and pushed onto it
+ */
+static capbuf_t *get_buf(void)
+{
+    capbuf_t *b, *head;
+    int zero;
+
+    if (my_buf != NULL)
+	return my_buf;
+    for (b = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE); b; b = b->next) {
+	zero = 0;
+	if (__atomic_compare_exchange_n(&b->owned, &zero, 1, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+	    break;
+    }
+    if (b == NULL) {
+	b = mmap(NULL, sizeof(capbuf_t), PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (b == MAP_FAILED)
+	    return NULL;
+	b->owned = 1;
+	b->n = 0;
+	head = __atomic_load_n(&buffers, __ATOMIC_RELAXED);
+	do
+	    b->next = head;
+	while (!__atomic_compare_exchange_n(&buffers, &head, b, 0,
+					    __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+    if (my_thread < 0)
+	my_thread = __atomic_fetch_add(&num_threads, 1, __ATOMIC_RELAXED);
+    my_buf = b;
+    pthread_setspecific(exit_key, b);
+    return b;
+}
+
+/*
+ * record - Add one record to this thread's buffer
+ */
+static void record(int type, void *ptr, size_t size)
+{
+    capbuf_t *b;
+    capture_rec_t *r;
+
+    if (!capturing || busy)
+	return;
+    busy = 1;
+    if ((b = get_buf()) != NULL) {
+	r = &b->rec[b->n];
+	r->seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+	r->ptr = (uintptr_t)ptr;
+	r->size = size;
+	r->thread = my_thread;
+	r->type = type;
+	if (type == CAP_ALLOC)
+	    __atomic_fetch_add(&num_ids, 1, __ATOMIC_RELAXED);
+	if (++b->n == CAPTURE_BUF)
+	    flush(b);
+    }
+    busy = 0;
+}
+
+/*
+ * capture_child - A forked child stops recording, so that it does not
+ *     write its copy of the parent's buffers to the parent's log
+ */
+static void capture_child(void)
+{
+    capturing = 0;
+}
+
+/*
+ * capture_init - Open the log and start recording
+ */
+__attribute__((constructor))
+static void capture_init(void)
+{
+    capture_hdr_t hdr;
+    char *path = getenv(CAPTURE_ENV);
+
+    strncpy(log_path, path ? path : CAPTURE_DEFAULT, sizeof(log_path) - 1);
+    log_fd = open(log_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (log_fd < 0)
+	return;
+    memset(&hdr, 0, sizeof(hdr));
+    if (write(log_fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+	return;
+    if (pthread_key_create(&exit_key, thread_exit) != 0)
+	return;
+    pthread_atfork(NULL, NULL, capture_child);
+    capturing = 1;
+}
+
+/*
+ * capture_fini - Flush this thread's buffer and every buffer no thread
+ *     holds, and fill in the header. A buffer is claimed before it is
+ *     flushed, so one its thread is still appending to or flushing is
+ *     never written twice or torn.
+ */
+__attribute__((destructor))
+static void capture_fini(void)
+{
+    capture_hdr_t hdr;
+    capbuf_t *b;
+    int fd, zero;
+
+    if (!capturing)
+	return;
+    capturing = 0;
+    busy = 1;
+    if (my_buf != NULL)
+	flush(my_buf);
+    for (b = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE); b; b = b->next) {
+	zero = 0;
+	if (__atomic_compare_exchange_n(&b->owned, &zero, 1, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+	    flush(b);
+    }
+
+    memcpy(hdr.magic, CAPTURE_MAGIC, sizeof(hdr.magic));
+    hdr.num_ids = __atomic_load_n(&num_ids, __ATOMIC_RELAXED);
+    hdr.num_ops = __atomic_load_n(&next_seq, __ATOMIC_RELAXED);
+    hdr.num_threads = __atomic_load_n(&num_threads, __ATOMIC_RELAXED);
+    if ((fd = open(log_path, O_WRONLY)) >= 0) {
+	if (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+	    hdr.num_ops = 0; /* cap2rep will fall back on the records */
+	close(fd);
+    }
+    close(log_fd);
+}
+
+/*
+ * The interposed functions
+ */
+void *malloc(size_t size)
+{
+    void *p = __libc_malloc(size);
+
+    if (p != NULL)
+	record(CAP_ALLOC, p, size);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p = __libc_calloc(nmemb, size);
+
+    if (p != NULL)
+	record(CAP_ALLOC, p, nmemb * size);
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    if (ptr == NULL)
+	return malloc(size);
+    if (size == 0) {
+	free(ptr);
+	return NULL;
+    }
+    record(CAP_REALLOC0, ptr, 0);
+    p = __libc_realloc(ptr, size);
+    record(CAP_REALLOC1, p ? p : ptr, p ? size : 0);
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL)
+	return;
+    record(CAP_FREE, ptr, 0);
+    __libc_free(ptr);
+}
+
+void *memalign(size_t align, size_t size)
+{
+    void *p = __libc_memalign(align, size);
+
+    if (p != NULL)
+	record(CAP_ALLOC, p, size);
+    return p;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    return memalign(align, size);
+}
+
+int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    void *p;
+
+    if (align < sizeof(void *) || (align & (align - 1)) != 0)
+	return EINVAL;
+    if ((p = memalign(align, size)) == NULL)
+	return ENOMEM;
+    *memptr = p;
+    return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef __CAPTURE_H_
+#define __CAPTURE_H_
+
+/*
+ * capture.h - The log written by the allocation capture library
+ *     (libcapture.so, from capture.c) and read by cap2rep
+ *
+ * A log is a capture_hdr_t followed by capture_rec_t records, written a
+ * thread's buffer at a time, so the records of different threads
+ * interleave in blocks. Each record carries a sequence number from a
+ * single counter shared by all threads, which puts them back in the
+ * order the program made its requests. A block is recorded as freed
+ * before it is handed back to libc and as allocated after libc has
+ * returned it, so when an address is reused its free always comes
+ * first.
+ */
+#include <stdint.h>
+
+#define CAPTURE_MAGIC   "MLCAP001"
+#define CAPTURE_ENV     "CAPTURE_FILE"  /* names the log... */
+#define CAPTURE_DEFAULT "malloc.cap"    /* ... or this, if it is not set */
+#define CAPTURE_BUF     4096            /* records a thread buffers */
+
+/* Record types. A realloc is two records: the old block is released
+   before libc is called and the new one attached after it returns. */
+#define CAP_ALLOC     1  /* ptr is a new block of size bytes */
+#define CAP_FREE      2  /* ptr is about to be freed */
+#define CAP_REALLOC0  3  /* ptr is about to be reallocated... */
+#define CAP_REALLOC1  4  /* ...and is now at ptr, with size bytes (0 if
+			    realloc failed and left the old block) */
+
+/* Filled in as the program exits; all zero if it never got there */
+typedef struct {
+    char magic[8];
+    uint64_t num_ids;      /* blocks allocated, the .rep num_ids */
+    uint64_t num_ops;      /* records written, from which num_ops comes */
+    uint64_t num_threads;  /* threads that made requests */
+} capture_hdr_t;
+
+typedef struct {
+    uint64_t seq;      /* place in the program's order of requests */
+    uint64_t ptr;      /* the block's address */
+    uint64_t size;     /* requested bytes, for CAP_ALLOC and CAP_REALLOC1 */
+    uint32_t thread;   /* 0, 1, ... in order of each thread's first request */
+    uint32_t type;     /* CAP_xxx */
+} capture_rec_t;
+
+#endif /* __CAPTURE_H_ */
@@ -1,6 +1,6 @@
 /* 
- * clock.c - Routines for using the cycle counters on x86, 
- *           Alpha, and Sparc boxes.
+ * clock.c - Routines for using the cycle counters on x86, x86-64,
+ *           AArch64, Alpha, and Sparc boxes.
  * 
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
@@ -9,14 +9,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/times.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
 #include "clock.h"
 
 
 /******************************************************* 
  * Machine dependent functions 
  *
- * Note: the constants __i386__ and  __alpha
+ * Note: the constants __i386__, __x86_64__, __aarch64__ and __alpha
  * are set by GCC when it calls the C preprocessor
  * You can verify this for yourself using gcc -v.
  *******************************************************/
@@ -71,6 +75,93 @@ double get_counter()
 }
 /* $end x86cyclecounter */
 
+/* The Pentium counter is assumed usable */
+int counter_available()
+{
+    return 1;
+}
+
+#elif defined(__x86_64__) || defined(__aarch64__)
+/*******************************************************************
+ * x86-64 and AArch64 versions of start_counter() and get_counter()
+ *
+ * x86-64 reads the time stamp counter. The reads are fenced so the
+ * code being timed can't drift across them: the start is lfence,
+ * rdtsc, lfence, and the end is rdtscp followed by lfence. AArch64
+ * reads the virtual count of the generic timer after an isb. Both
+ * tick at a constant rate that need not be the core clock, so mhz()
+ * calibrates the rate against the monotonic clock.
+ *******************************************************************/
+
+static uint64_t cyc_start = 0;
+
+/* Read the counter at the start of a measurement */
+static inline uint64_t counter_begin(void)
+{
+#if defined(__x86_64__)
+    uint64_t t;
+
+    _mm_lfence();
+    t = __rdtsc();
+    _mm_lfence();
+    return t;
+#else
+    uint64_t t;
+
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r" (t) :: "memory");
+    return t;
+#endif
+}
+
+/* Read the counter at the end of a measurement */
+static inline uint64_t counter_end(void)
+{
+#if defined(__x86_64__)
+    unsigned aux;
+    uint64_t t;
+
+    t = __rdtscp(&aux);
+    _mm_lfence();
+    return t;
+#else
+    uint64_t t;
+
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r" (t) :: "memory");
+    return t;
+#endif
+}
+
+/* Record the current value of the cycle counter. */
+void start_counter()
+{
+    cyc_start = counter_begin();
+}
+
+/* Return the number of cycles since the last call to start_counter. */
+double get_counter()
+{
+    return (double)(counter_end() - cyc_start);
+}
+
+/* 
+ * counter_available - The TSC is only a clock if it is invariant,
+ * i.e. keeps a constant rate through frequency and power state
+ * changes (CPUID leaf 0x80000007, EDX bit 8). The AArch64 generic
+ * timer always is.
+ */
+int counter_available()
+{
+#if defined(__x86_64__)
+    unsigned eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+	return 0;
+    return (edx >> 8) & 1;
+#else
+    return 1;
+#endif
+}
+
 #elif defined(__alpha)
 
 /****************************************************
@@ -133,6 +224,12 @@ double get_counter()
     return result;
 }
 
+/* The Alpha counter is assumed usable */
+int counter_available()
+{
+    return 1;
+}
+
 #else
 
 /****************************************************************
@@ -158,6 +255,11 @@ double get_counter()
     printf("Please choose another timing package in config.h.\n");
     exit(1);
 }
+
+int counter_available()
+{
+    return 0;
+}
 #endif
 
 
@@ -195,10 +297,46 @@ double mhz_full(int verbose, int sleeptime)
 }
 /* $end mhz */
 
-/* Version using a default sleeptime */
+/*
+ * mhz - Estimate the counter rate against the monotonic clock: spin
+ * for CALIB_NSECS a few times, counting ticks, and take the median
+ * rate. Much quicker than sleeping, and the spin keeps the CPU from
+ * idling in the middle of a measurement.
+ */
+#define CALIB_ROUNDS 5
+#define CALIB_NSECS  20000000  /* 20 ms */
+
+static double mono_nsecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
 double mhz(int verbose)
 {
-    return mhz_full(verbose, 2);
+    double rate[CALIB_ROUNDS], t0, t1, tmp;
+    int i, j;
+
+    for (i = 0; i < CALIB_ROUNDS; i++) {
+	t0 = mono_nsecs();
+	start_counter();
+	while ((t1 = mono_nsecs()) - t0 < CALIB_NSECS)
+	    ;
+	rate[i] = get_counter() / ((t1 - t0) * 1e-3); /* ticks per usec */
+    }
+
+    /* Insertion sort, then take the middle */
+    for (i = 1; i < CALIB_ROUNDS; i++)
+	for (j = i; j > 0 && rate[j-1] > rate[j]; j--) {
+	    tmp = rate[j-1];
+	    rate[j-1] = rate[j];
+	    rate[j] = tmp;
+	}
+    if (verbose) 
+	printf("Processor clock rate ~= %.1f MHz\n", rate[CALIB_ROUNDS/2]);
+    return rate[CALIB_ROUNDS/2];
 }
 
 /** Special counters that compensate for timer interrupt overhead */
@@ -1,3 +1,12 @@
+#ifndef __CLOCK_H_
+#define __CLOCK_H_
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
 /* Routines for using cycle counter */
 
 /* Start the counter */
@@ -6,10 +15,13 @@ void start_counter();
 /* Get # cycles since counter started */
 double get_counter();
 
+/* Does this CPU have a counter start_counter can use? */
+int counter_available();
+
 /* Measure overhead for counter */
 double ovhd();
 
-/* Determine clock rate of processor (using a default sleeptime) */
+/* Determine the counter rate in MHz, calibrated against the monotonic clock */
 double mhz(int verbose);
 
 /* Determine clock rate of processor, having more control over accuracy */
@@ -20,3 +32,29 @@ double mhz_full(int verbose, int sleeptime);
 void start_comp_counter();
 
 double get_comp_counter();
+
+/*
+ * cycle_stamp - Read the counter as cheaply as possible, for timing
+ *     individual operations. The lfence keeps rdtsc from being hoisted
+ *     above the loads that precede it. Platforms without a user-mode
+ *     counter fall back to nanoseconds from the monotonic clock.
+ */
+static inline uint64_t cycle_stamp(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_lfence();
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t t;
+
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r" (t) :: "memory");
+    return t;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+#endif /* __CLOCK_H_ */
@@ -46,8 +46,15 @@
  * students surpass the AVG_LIBC_THRUPUT, they get no further benefit
  * to their score.  This deters students from building extremely fast,
  * but extremely stupid malloc packages.
+ *
+ * Any modern machine leaves this figure far behind, so the driver's
+ * --calibrate option measures libc's throughput on the traces on this
+ * host and saves it in CALIBRATION_FILE (or the file named with
+ * --calibration). Later runs that find the file cap throughput there
+ * instead, and fall back on AVG_LIBC_THRUPUT only when there is none.
  */
 #define AVG_LIBC_THRUPUT      200E3  /* 200 Kops/sec */
+#define CALIBRATION_FILE      "mdriver.cal"
 
 #define MAX_UTIL        0.9
  /* 
@@ -63,15 +70,59 @@
 #define ALIGNMENT 16
 
 /* 
- * Maximum heap size in bytes 
+ * Default maximum heap size in bytes. The driver's -M flag overrides
+ * it at runtime.
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
+/*
+ * The heap is reserved as address space and committed MEM_COMMIT_CHUNK
+ * bytes at a time as the brk advances. mem_trim, which the driver calls
+ * between traces (never between timed runs of one trace), releases
+ * committed memory above MEM_COMMIT_WATERMARK. Both must be multiples of the page
+ * size.
+ */
+#define MEM_COMMIT_CHUNK     (64*(1<<10))   /* 64 KB */
+#define MEM_COMMIT_WATERMARK (256*(1<<10))  /* 256 KB */
+
+/*
+ * With -S, traces are replayed in windows of STREAM_WINDOW ops, two of
+ * which are held in memory at a time.
+ */
+#define STREAM_WINDOW (1<<16)
+
+/*
+ * Each -T measurement is the fastest of MT_RUNS replays
+ */
+#define MT_RUNS 3
+
 /*****************************************************************************
- * Set exactly one of these USE_xxx constants to "1" to select a timing method
+ * Set USE_FCYC to "1" to time with the cycle counter and the K-best scheme
+ * whenever clock.c finds a usable counter on the CPU (x86-64 with an
+ * invariant TSC, AArch64, x86, Alpha). Set exactly one of the others to
+ * "1" to select the timing method used otherwise.
  *****************************************************************************/
-#define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
+#define USE_FCYC   1   /* cycle counter w/K-best scheme, when available */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
 #define USE_GETTOD 1   /* gettimeofday (any Unix box) */
 
+/*
+ * fsecs_dist (the driver's -R option) runs FSECS_WARMUP untimed runs,
+ * then times at least FSECS_MIN_SAMPLES and at most FSECS_MAX_SAMPLES
+ * runs, stopping once the 95% confidence interval for the median is
+ * within FSECS_CI_TARGET of it on either side.
+ */
+#define FSECS_WARMUP       2
+#define FSECS_MIN_SAMPLES 10
+#define FSECS_MAX_SAMPLES 200
+#define FSECS_CI_TARGET   0.01
+
+/*
+ * --baseline flags a trace whose throughput or utilization dropped by
+ * more than REGRESS_THRESHOLD (the --threshold option overrides it). A
+ * throughput change counts only if it is significant, judged by the -R
+ * confidence intervals, which --baseline turns on for its own run.
+ */
+#define REGRESS_THRESHOLD 0.05
+
 #endif /* __CONFIG_H */
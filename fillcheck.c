@@ -0,0 +1,85 @@
+/*
+ * fillcheck.c - Check that a payload still holds the byte it was
+ *     filled with
+ *
+ * The payload is compared 16 bytes at a time with SSE2 on x86 and
+ * NEON on AArch64, and a word at a time elsewhere, once the bytes up
+ * to the first 16-byte boundary are done. On x86 four vectors are
+ * compared per step and only a step that mismatches is searched for
+ * the offending byte, so a clean payload costs about as much to check
+ * as it did to fill.
+ */
+#include <stdint.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "fillcheck.h"
+
+/*
+ * fill_check - Offset of the first byte in [p, p+len) that is not
+ *     byte, or len if they all are
+ */
+size_t fill_check(const void *p, int byte, size_t len)
+{
+    const unsigned char *s = (const unsigned char *)p;
+    unsigned char b = (unsigned char)byte;
+    size_t i = 0;
+
+    while (i < len && ((uintptr_t)(s + i) & 15) != 0) {
+	if (s[i] != b)
+	    return i;
+	i++;
+    }
+
+#if defined(__SSE2__)
+    {
+	__m128i want = _mm_set1_epi8((char)b);
+	__m128i eq;
+	unsigned m;
+
+	for (; i + 64 <= len; i += 64) {
+	    eq = _mm_and_si128(
+		_mm_and_si128(
+		    _mm_cmpeq_epi8(_mm_load_si128((const __m128i *)(s + i)), want),
+		    _mm_cmpeq_epi8(_mm_load_si128((const __m128i *)(s + i + 16)), want)),
+		_mm_and_si128(
+		    _mm_cmpeq_epi8(_mm_load_si128((const __m128i *)(s + i + 32)), want),
+		    _mm_cmpeq_epi8(_mm_load_si128((const __m128i *)(s + i + 48)), want)));
+	    if (_mm_movemask_epi8(eq) != 0xFFFF)
+		break;
+	}
+	for (; i + 16 <= len; i += 16) {
+	    eq = _mm_cmpeq_epi8(_mm_load_si128((const __m128i *)(s + i)), want);
+	    if ((m = _mm_movemask_epi8(eq)) != 0xFFFF)
+		return i + __builtin_ctz(~m);
+	}
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    {
+	uint8x16_t want = vdupq_n_u8(b);
+
+	for (; i + 16 <= len; i += 16)
+	    if (vminvq_u8(vceqq_u8(vld1q_u8(s + i), want)) != 0xFF)
+		break;
+    }
+#else
+    {
+	uint64_t want = 0x0101010101010101ULL * b, w;
+
+	for (; i + 8 <= len; i += 8) {
+	    memcpy(&w, s + i, sizeof(w));
+	    if (w != want)
+		break;
+	}
+    }
+#endif
+
+    for (; i < len; i++)
+	if (s[i] != b)
+	    return i;
+    return len;
+}
@@ -0,0 +1,18 @@
+#ifndef __FILLCHECK_H_
+#define __FILLCHECK_H_
+
+/*
+ * fillcheck.h - Check that a payload still holds the byte it was
+ *     filled with
+ *
+ * The driver fills each block with the low byte of its id when it is
+ * allocated. With -c it checks the fill again before the block is
+ * freed and, for blocks still live, at the end of the trace, so an
+ * allocator that writes its metadata into a live payload is caught.
+ */
+#include <stddef.h>
+
+/* Offset of the first byte in [p, p+len) that is not byte, or len */
+size_t fill_check(const void *p, int byte, size_t len);
+
+#endif /* __FILLCHECK_H_ */
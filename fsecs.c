@@ -1,7 +1,13 @@
 /****************************
  * High-level timing wrappers
  ****************************/
+#define _GNU_SOURCE   /* for sched_getcpu */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sched.h>
 #include "fsecs.h"
 #include "fcyc.h"
 #include "clock.h"
@@ -9,28 +15,37 @@
 #include "config.h"
 
 static double Mhz;  /* estimated CPU clock frequency */
+static int use_fcyc; /* time with fcyc? */
+static int warmup = FSECS_WARMUP;          /* fsecs_dist warmup runs */
+static double ci_target = FSECS_CI_TARGET; /* fsecs_dist stopping rule */
 
 extern int verbose; /* -v option in mdriver.c */
 
 /*
- * init_fsecs - initialize the timing package
+ * init_fsecs - initialize the timing package, preferring the cycle
+ *     counter when the CPU has a usable one
  */
 void init_fsecs(void)
 {
     Mhz = 0; /* keep gcc -Wall happy */
 
-#if USE_FCYC
-    if (verbose)
-	printf("Measuring performance with a cycle counter.\n");
-
-    /* set key parameters for the fcyc package */
-    set_fcyc_maxsamples(20); 
-    set_fcyc_clear_cache(1);
-    set_fcyc_compensate(1);
-    set_fcyc_epsilon(0.01);
-    set_fcyc_k(3);
-    Mhz = mhz(verbose > 0);
-#elif USE_ITIMER
+    use_fcyc = USE_FCYC && counter_available();
+    if (use_fcyc) {
+	if (verbose)
+	    printf("Measuring performance with a cycle counter.\n");
+
+	/* set key parameters for the fcyc package. Tick compensation is
+	   off: calibrating it spins for a second or more, and K-best
+	   already discards the samples that timer interrupts inflate. */
+	set_fcyc_maxsamples(20); 
+	set_fcyc_clear_cache(1);
+	set_fcyc_compensate(0);
+	set_fcyc_epsilon(0.01);
+	set_fcyc_k(3);
+	Mhz = mhz(verbose > 0);
+	return;
+    }
+#if USE_ITIMER
     if (verbose)
 	printf("Measuring performance with the interval timer.\n");
 #elif USE_GETTOD
@@ -44,14 +59,128 @@ void init_fsecs(void)
  */
 double fsecs(fsecs_test_funct f, void *argp) 
 {
-#if USE_FCYC
-    double cycles = fcyc(f, argp);
-    return cycles/(Mhz*1e6);
-#elif USE_ITIMER
+    if (use_fcyc) {
+	double cycles = fcyc(f, argp);
+	return cycles/(Mhz*1e6);
+    }
+#if USE_ITIMER
     return ftimer_itimer(f, argp, 10);
-#elif USE_GETTOD
+#else
     return ftimer_gettod(f, argp, 10);
 #endif 
 }
 
+/*
+ * time_once - Time a single run of f (in seconds), with the cycle
+ *     counter if we have one and the monotonic clock otherwise
+ */
+static double time_once(fsecs_test_funct f, void *argp)
+{
+    struct timespec t0, t1;
+
+    if (use_fcyc) {
+	start_counter();
+	f(argp);
+	return get_counter()/(Mhz*1e6);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    f(argp);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+}
+
+/*
+ * cmp_double - qsort comparison for doubles
+ */
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * median - Median of the n sorted values in x
+ */
+static double median(double *x, int n)
+{
+    return (n % 2) ? x[n/2] : (x[n/2 - 1] + x[n/2]) / 2;
+}
 
+/*
+ * summarize - Fill in *d from the n samples in x. The confidence
+ *     interval for the median is distribution-free: it runs between
+ *     the order statistics n/2 -/+ 1.96*sqrt(n)/2, from the normal
+ *     approximation to the binomial.
+ */
+static void summarize(double *x, int n, double *tmp, fsecs_dist_t *d)
+{
+    int i, lo, hi;
+
+    memcpy(tmp, x, n * sizeof(double));
+    qsort(tmp, n, sizeof(double), cmp_double);
+    d->samples = n;
+    d->median = median(tmp, n);
+    lo = (int)floor(n/2.0 - 0.98*sqrt(n));
+    hi = (int)ceil(n/2.0 + 0.98*sqrt(n)) - 1;
+    d->ci_lo = tmp[lo < 0 ? 0 : lo];
+    d->ci_hi = tmp[hi > n-1 ? n-1 : hi];
+
+    for (i = 0; i < n; i++)
+	tmp[i] = fabs(x[i] - d->median);
+    qsort(tmp, n, sizeof(double), cmp_double);
+    d->mad = median(tmp, n);
+}
+
+/*
+ * fsecs_dist - Return the median running time of f (in seconds) and
+ *     describe the distribution in *d
+ */
+double fsecs_dist(fsecs_test_funct f, void *argp, fsecs_dist_t *d)
+{
+    double x[FSECS_MAX_SAMPLES], tmp[FSECS_MAX_SAMPLES];
+    cpu_set_t saved, one;
+    int i, n, cpu, pinned = 0;
+
+    /* Stay on one CPU for the whole measurement */
+    if ((cpu = sched_getcpu()) >= 0 &&
+	sched_getaffinity(0, sizeof(saved), &saved) == 0) {
+	CPU_ZERO(&one);
+	CPU_SET(cpu, &one);
+	pinned = (sched_setaffinity(0, sizeof(one), &one) == 0);
+    }
+
+    for (i = 0; i < warmup; i++)
+	f(argp);
+    for (n = 0; n < FSECS_MAX_SAMPLES; ) {
+	x[n++] = time_once(f, argp);
+	if (n >= FSECS_MIN_SAMPLES) {
+	    summarize(x, n, tmp, d);
+	    if (d->ci_hi - d->ci_lo <= 2 * ci_target * d->median)
+		break;
+	}
+    }
+    if (n < FSECS_MIN_SAMPLES)
+	summarize(x, n, tmp, d);
+
+    if (pinned)
+	sched_setaffinity(0, sizeof(saved), &saved);
+    return d->median;
+}
+
+/*
+ * set_fsecs_warmup - Number of warmup runs before fsecs_dist starts timing
+ */
+void set_fsecs_warmup(int n)
+{
+    warmup = n;
+}
+
+/*
+ * set_fsecs_ci_target - Relative half-width of the confidence interval
+ *     at which fsecs_dist stops sampling
+ */
+void set_fsecs_ci_target(double rel)
+{
+    ci_target = rel;
+}
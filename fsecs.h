@@ -1,4 +1,27 @@
 typedef void (*fsecs_test_funct)(void *);
 
+/* The distribution of running times measured by fsecs_dist */
+typedef struct {
+    double median;   /* median running time (secs) */
+    double mad;      /* median absolute deviation from the median (secs) */
+    double ci_lo;    /* 95% confidence interval for the median (secs) */
+    double ci_hi;
+    int samples;     /* timed runs, not counting warmup */
+} fsecs_dist_t;
+
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+
+/*
+ * fsecs_dist - Pin to the current CPU, run f a few times to warm up,
+ *     then time runs of f one by one until the 95% confidence interval
+ *     for the median is narrow enough (or FSECS_MAX_SAMPLES is hit).
+ *     Fills in *d and returns the median.
+ */
+double fsecs_dist(fsecs_test_funct f, void *argp, fsecs_dist_t *d);
+
+/* Number of warmup runs before fsecs_dist starts timing */
+void set_fsecs_warmup(int n);
+
+/* Half-width of the confidence interval to aim for, relative to the median */
+void set_fsecs_ci_target(double rel);
@@ -0,0 +1,508 @@
+/*
+ * gentrace.c - Generate synthetic malloc lab traces from a spec
+ *
+ * usage: gentrace [-t] [-s <seed>] <specfile> <outfile>
+ *
+ * The spec file holds one setting per line; '#' starts a comment:
+ *
+ *     ops <n>                  total requests, including the final frees
+ *     live <n>                 target number of live blocks
+ *     size <dist>              request sizes in bytes
+ *     lifetime <dist>          block lifetimes, in requests
+ *     realloc <fraction>       share of requests that are reallocs
+ *     threads <n>              threads making the requests
+ *     remote <fraction>        share of frees made by another thread
+ *     seed <n>                 random seed (-s overrides it)
+ *
+ * where <dist> is one of
+ *
+ *     uniform <lo> <hi>
+ *     lognormal <mu> <sigma>   ln(x) is normal with mean mu, sd sigma
+ *     exponential <mean>
+ *     empirical <bin> ...      each bin is <x>:<weight> or <lo>-<hi>:<weight>
+ *
+ * Blocks are allocated until the live-set target is reached and are
+ * freed when their sampled lifetime runs out; above the target the
+ * block due to die soonest is freed early. Once the remaining requests
+ * are only enough to free what is live, the trace drains, so it ends
+ * with every block freed whenever the op count allows it.
+ *
+ * With more than one thread, each block is allocated by a random
+ * thread, which also reallocs it and, unless the free is remote, frees
+ * it.
+ *
+ * Since the driver does not replay realloc, each realloc is written as
+ * a free and an allocation of the same id, as cap2rep does by default;
+ * it still counts as one request towards ops.
+ *
+ * The output is binary, or text with -t. Generation uses its own
+ * random number generator, so a spec and seed always give the same
+ * trace. The trace is generated twice: once to count the ids that go
+ * in the header, then again to write it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "trace.h"
+
+#define MAXLINE 1024 /* max string size */
+#define MAXBINS 256  /* max bins in an empirical distribution */
+
+int verbose = 0;     /* read by trace.c */
+
+/* A distribution to draw sizes or lifetimes from */
+typedef struct {
+    enum {UNIFORM, LOGNORMAL, EXPONENTIAL, EMPIRICAL} type;
+    double a, b;              /* uniform: lo, hi; lognormal: mu, sigma;
+				 exponential: mean */
+    int nbins;                /* empirical: number of bins... */
+    double lo[MAXBINS];       /* ... the range of each... */
+    double hi[MAXBINS];
+    double cum[MAXBINS];      /* ... and the cumulative weights */
+} dist_t;
+
+/* The generator settings */
+typedef struct {
+    int ops;
+    int live;
+    dist_t size;
+    dist_t lifetime;
+    double realloc;
+    int threads;
+    double remote;
+    uint64_t seed;
+} spec_t;
+
+/* A live block and the request number at which it dies */
+typedef struct {
+    long death;
+    int id;
+} block_t;
+
+/* State of one generation run */
+typedef struct {
+    uint64_t rng;          /* random number generator state */
+    block_t *heap;         /* live blocks, a min-heap on death */
+    int nlive;             /* number of live blocks */
+    size_t *bytes;         /* size of each live id */
+    int *owner;            /* thread that allocated each live id */
+    int maxids;            /* capacity of heap and bytes */
+    int num_ids;           /* ids allocated so far */
+    long num_ops;          /* ops written, a split realloc being two */
+    size_t live_bytes;     /* payload bytes currently live */
+    size_t peak_bytes;     /* most payload bytes ever live */
+} gen_t;
+
+static char *specfile;     /* for error messages */
+static int specline;
+
+/*
+ * spec_error - Report a bad line in the spec file and exit
+ */
+static void spec_error(char *msg)
+{
+    fprintf(stderr, "gentrace: %s, line %d: %s\n", specfile, specline, msg);
+    exit(1);
+}
+
+/*********************
+ * Random numbers
+ *********************/
+
+/*
+ * next64 - splitmix64
+ */
+static uint64_t next64(gen_t *g)
+{
+    uint64_t z = (g->rng += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/*
+ * uniform01 - Uniform double in [0, 1)
+ */
+static double uniform01(gen_t *g)
+{
+    return (next64(g) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * normal01 - Standard normal deviate (Box-Muller)
+ */
+static double normal01(gen_t *g)
+{
+    double u1 = 1.0 - uniform01(g);    /* (0, 1] keeps log finite */
+    double u2 = uniform01(g);
+
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+/*
+ * sample - Draw one value from d
+ */
+static double sample(gen_t *g, dist_t *d)
+{
+    double u;
+    int lo, hi, mid;
+
+    switch (d->type) {
+    case UNIFORM:
+	return d->a + (d->b - d->a) * uniform01(g);
+    case LOGNORMAL:
+	return exp(d->a + d->b * normal01(g));
+    case EXPONENTIAL:
+	return -d->a * log(1.0 - uniform01(g));
+    case EMPIRICAL:
+	/* Find the first bin whose cumulative weight exceeds u */
+	u = uniform01(g) * d->cum[d->nbins-1];
+	for (lo = 0, hi = d->nbins-1; lo < hi; ) {
+	    mid = (lo + hi) / 2;
+	    if (d->cum[mid] > u)
+		hi = mid;
+	    else
+		lo = mid + 1;
+	}
+	return d->lo[lo] + (d->hi[lo] - d->lo[lo]) * uniform01(g);
+    }
+    return 0;
+}
+
+/*********************
+ * Reading the spec
+ *********************/
+
+/*
+ * parse_num - Parse a number that must be at least min
+ */
+static double parse_num(char *tok, double min)
+{
+    char *end;
+    double x;
+
+    if (tok == NULL)
+	spec_error("Missing number");
+    x = strtod(tok, &end);
+    if (end == tok || *end != '\0')
+	spec_error("Bad number");
+    if (x < min)
+	spec_error("Number out of range");
+    return x;
+}
+
+/*
+ * parse_dist - Parse the rest of a size or lifetime line into d
+ */
+static void parse_dist(dist_t *d)
+{
+    char *tok = strtok(NULL, " \t\n"), *colon, *dash;
+    double w, total = 0;
+
+    if (tok == NULL)
+	spec_error("Missing distribution");
+    memset(d, 0, sizeof(dist_t));
+    if (!strcmp(tok, "uniform")) {
+	d->type = UNIFORM;
+	d->a = parse_num(strtok(NULL, " \t\n"), 0);
+	d->b = parse_num(strtok(NULL, " \t\n"), d->a);
+    }
+    else if (!strcmp(tok, "lognormal")) {
+	d->type = LOGNORMAL;
+	d->a = parse_num(strtok(NULL, " \t\n"), -HUGE_VAL);
+	d->b = parse_num(strtok(NULL, " \t\n"), 0);
+    }
+    else if (!strcmp(tok, "exponential")) {
+	d->type = EXPONENTIAL;
+	d->a = parse_num(strtok(NULL, " \t\n"), 0);
+    }
+    else if (!strcmp(tok, "empirical")) {
+	d->type = EMPIRICAL;
+	while ((tok = strtok(NULL, " \t\n")) != NULL) {
+	    if (d->nbins == MAXBINS)
+		spec_error("Too many bins");
+	    if ((colon = strchr(tok, ':')) == NULL)
+		spec_error("Bins look like <x>:<weight> or <lo>-<hi>:<weight>");
+	    *colon = '\0';
+	    if ((dash = strchr(tok, '-')) != NULL) {
+		*dash = '\0';
+		d->lo[d->nbins] = parse_num(tok, 0);
+		d->hi[d->nbins] = parse_num(dash+1, d->lo[d->nbins]);
+	    }
+	    else
+		d->lo[d->nbins] = d->hi[d->nbins] = parse_num(tok, 0);
+	    w = parse_num(colon+1, 0);
+	    total += w;
+	    d->cum[d->nbins++] = total;
+	}
+	if (total <= 0)
+	    spec_error("Empirical distribution has no weight");
+    }
+    else
+	spec_error("Unknown distribution");
+    if ((tok = strtok(NULL, " \t\n")) != NULL)
+	spec_error("Extra text after distribution");
+}
+
+/*
+ * read_spec - Read the spec file at path into s
+ */
+static void read_spec(char *path, spec_t *s)
+{
+    FILE *fp;
+    char line[MAXLINE], *key, *hash;
+
+    /* Defaults: a small trace of mixed sizes */
+    s->ops = 100000;
+    s->live = 1000;
+    s->size.type = UNIFORM;
+    s->size.a = 1;
+    s->size.b = 4096;
+    s->lifetime.type = EXPONENTIAL;
+    s->lifetime.a = 1000;
+    s->realloc = 0;
+    s->threads = 1;
+    s->remote = 0;
+    s->seed = 1;
+
+    specfile = path;
+    if ((fp = fopen(path, "r")) == NULL) {
+	perror(path);
+	exit(1);
+    }
+    for (specline = 1; fgets(line, MAXLINE, fp) != NULL; specline++) {
+	if ((hash = strchr(line, '#')) != NULL)
+	    *hash = '\0';
+	if ((key = strtok(line, " \t\n")) == NULL)
+	    continue;
+	if (!strcmp(key, "ops"))
+	    s->ops = parse_num(strtok(NULL, " \t\n"), 0);
+	else if (!strcmp(key, "live"))
+	    s->live = parse_num(strtok(NULL, " \t\n"), 1);
+	else if (!strcmp(key, "size"))
+	    parse_dist(&s->size);
+	else if (!strcmp(key, "lifetime"))
+	    parse_dist(&s->lifetime);
+	else if (!strcmp(key, "realloc")) {
+	    s->realloc = parse_num(strtok(NULL, " \t\n"), 0);
+	    if (s->realloc > 1)
+		spec_error("Realloc fraction must be at most 1");
+	}
+	else if (!strcmp(key, "threads"))
+	    s->threads = parse_num(strtok(NULL, " \t\n"), 1);
+	else if (!strcmp(key, "remote")) {
+	    s->remote = parse_num(strtok(NULL, " \t\n"), 0);
+	    if (s->remote > 1)
+		spec_error("Remote free fraction must be at most 1");
+	}
+	else if (!strcmp(key, "seed")) {
+	    if ((key = strtok(NULL, " \t\n")) == NULL)
+		spec_error("Missing number");
+	    s->seed = strtoull(key, NULL, 0);
+	}
+	else
+	    spec_error("Unknown setting");
+    }
+    fclose(fp);
+}
+
+/*********************
+ * Generating
+ *********************/
+
+/*
+ * heap_swap, sift_up, sift_down - Maintain the min-heap of live
+ *     blocks ordered by death
+ */
+static void heap_swap(gen_t *g, int i, int j)
+{
+    block_t t = g->heap[i];
+
+    g->heap[i] = g->heap[j];
+    g->heap[j] = t;
+}
+
+static void sift_up(gen_t *g, int i)
+{
+    while (i > 0 && g->heap[(i-1)/2].death > g->heap[i].death) {
+	heap_swap(g, i, (i-1)/2);
+	i = (i-1)/2;
+    }
+}
+
+static void sift_down(gen_t *g, int i)
+{
+    int c;
+
+    while ((c = 2*i + 1) < g->nlive) {
+	if (c+1 < g->nlive && g->heap[c+1].death < g->heap[c].death)
+	    c++;
+	if (g->heap[i].death <= g->heap[c].death)
+	    break;
+	heap_swap(g, i, c);
+	i = c;
+    }
+}
+
+/*
+ * draw_size - Sample a request size, at least one byte
+ */
+static size_t draw_size(gen_t *g, spec_t *s)
+{
+    double x = sample(g, &s->size);
+
+    return x < 1 ? 1 : (size_t)(x + 0.5);
+}
+
+/*
+ * generate - Produce the trace for s, passing each op to w unless w is
+ *     NULL; fills in the id and op counts and peak live bytes in g
+ */
+static void generate(spec_t *s, gen_t *g, trace_writer_t *w)
+{
+    long t;
+    int i, id;
+    double life;
+    traceop_t op;
+
+    op.thread = 0;
+    g->rng = s->seed;
+    g->nlive = g->num_ids = 0;
+    g->num_ops = 0;
+    g->live_bytes = g->peak_bytes = 0;
+
+    for (t = 0; t < s->ops; t++) {
+	long left = s->ops - t;
+
+	if (g->nlive > 0 &&
+	    (g->heap[0].death <= t || left <= g->nlive || g->nlive >= s->live)) {
+	    /* Free the block due to die first */
+	    op.type = FREE;
+	    op.index = id = g->heap[0].id;
+	    op.size = 0;
+	    if (s->threads > 1) {
+		op.thread = g->owner[id];
+		if (uniform01(g) < s->remote)
+		    op.thread = (op.thread + 1 + next64(g) % (s->threads - 1))
+			% s->threads;
+	    }
+	    g->live_bytes -= g->bytes[id];
+	    heap_swap(g, 0, --g->nlive);
+	    sift_down(g, 0);
+	}
+	else if (g->nlive > 0 && uniform01(g) < s->realloc) {
+	    /* Resize a random live block; its lifetime stays the same */
+	    i = next64(g) % g->nlive;
+	    op.type = REALLOC;
+	    op.index = id = g->heap[i].id;
+	    op.size = draw_size(g, s);
+	    op.thread = g->owner[id];
+	    g->live_bytes += op.size - g->bytes[id];
+	    g->bytes[id] = op.size;
+	}
+	else {
+	    /* Allocate a new block and decide when it dies */
+	    if (g->num_ids == g->maxids) {
+		g->maxids = g->maxids ? 2 * g->maxids : 4096;
+		g->bytes = (size_t *)realloc(g->bytes, g->maxids * sizeof(size_t));
+		g->heap = (block_t *)realloc(g->heap, g->maxids * sizeof(block_t));
+		g->owner = (int *)realloc(g->owner, g->maxids * sizeof(int));
+		if (g->bytes == NULL || g->heap == NULL || g->owner == NULL) {
+		    perror("gentrace: realloc");
+		    exit(1);
+		}
+	    }
+	    op.type = ALLOC;
+	    op.index = id = g->num_ids++;
+	    op.size = draw_size(g, s);
+	    life = sample(g, &s->lifetime);
+	    op.thread = (s->threads > 1) ? next64(g) % s->threads : 0;
+	    g->owner[id] = op.thread;
+	    g->bytes[id] = op.size;
+	    g->live_bytes += op.size;
+	    g->heap[g->nlive].id = id;
+	    g->heap[g->nlive].death = t + 1 + (long)(life < 0 ? 0 : life);
+	    sift_up(g, g->nlive++);
+	}
+	if (g->live_bytes > g->peak_bytes)
+	    g->peak_bytes = g->live_bytes;
+	if (op.type == REALLOC) {
+	    op.type = FREE;
+	    op.size = 0;
+	    if (w != NULL)
+		trace_write(w, &op);
+	    g->num_ops++;
+	    op.type = ALLOC;
+	    op.size = g->bytes[id];
+	}
+	if (w != NULL)
+	    trace_write(w, &op);
+	g->num_ops++;
+    }
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: gentrace [-t] [-s <seed>] <specfile> <outfile>\n");
+    fprintf(stderr, "\t-s <seed>  Use <seed> instead of the spec's seed.\n");
+    fprintf(stderr, "\t-t         Write the text .rep format instead of binary.\n");
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    int format = TRACE_BINARY;
+    int seed_set = 0;
+    uint64_t seed = 0;
+    spec_t spec;
+    gen_t gen;
+    trace_hdr_t hdr;
+    trace_writer_t *w;
+
+    while ((c = getopt(argc, argv, "s:th")) != EOF) {
+	switch (c) {
+	case 's':
+	    seed = strtoull(optarg, NULL, 0);
+	    seed_set = 1;
+	    break;
+	case 't':
+	    format = TRACE_TEXT;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (argc - optind != 2) {
+	usage();
+	exit(1);
+    }
+
+    read_spec(argv[optind], &spec);
+    if (seed_set)
+	spec.seed = seed;
+
+    /* Count the ids, then generate the same trace again for real */
+    memset(&gen, 0, sizeof(gen));
+    generate(&spec, &gen, NULL);
+    hdr.sugg_heapsize = gen.peak_bytes > INT32_MAX ? INT32_MAX : gen.peak_bytes;
+    hdr.num_ids = gen.num_ids;
+    hdr.num_ops = gen.num_ops;
+    hdr.weight = 1;
+    w = trace_create(argv[optind+1], &hdr, format);
+    generate(&spec, &gen, w);
+    trace_finish(w);
+
+    free(gen.heap);
+    free(gen.bytes);
+    free(gen.owner);
+    exit(0);
+}
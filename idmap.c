@@ -0,0 +1,143 @@
+/*
+ * idmap.c - Paged map from trace block ids to the blocks allocated
+ *     for them
+ *
+ * The directory has one pointer per IDMAP_PAGE ids, so it costs a few
+ * bytes per thousand ids; the pages themselves are only held while
+ * some id in them is live.
+ *
+ * Every page in the pool has all of its entries NULL: new pages come
+ * from calloc, a page idmap_remove releases has had each of its ids
+ * cleared on the way, and only pages idmap_clear drops while ids in
+ * them are still live need wiping. A page is never cleared when it is
+ * taken, which would cost a page's worth of stores per allocation on
+ * traces that keep few blocks live.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "idmap.h"
+
+/*
+ * idmap_error - Report an allocation failure and exit
+ */
+static void idmap_error(char *msg)
+{
+    printf("%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+/*
+ * idmap_create - Make an empty map for ids 0..num_ids-1
+ */
+idmap_t *idmap_create(int num_ids)
+{
+    idmap_t *m;
+
+    if ((m = (idmap_t *)malloc(sizeof(idmap_t))) == NULL)
+	idmap_error("malloc failed in idmap_create");
+    m->npages = (num_ids + IDMAP_PAGE - 1) / IDMAP_PAGE;
+    if ((m->dir = (idmap_page_t **)calloc(m->npages > 0 ? m->npages : 1,
+					  sizeof(idmap_page_t *))) == NULL)
+	idmap_error("calloc failed in idmap_create");
+    m->pool = NULL;
+    return m;
+}
+
+/*
+ * idmap_clear - Forget every id, keeping the pages for reuse
+ */
+void idmap_clear(idmap_t *m)
+{
+    int i;
+
+    for (i = 0; i < m->npages; i++) {
+	if (m->dir[i] != NULL) {
+	    if (m->dir[i]->live > 0)
+		memset(m->dir[i]->ent, 0, sizeof(m->dir[i]->ent));
+	    m->dir[i]->next = m->pool;
+	    m->pool = m->dir[i];
+	    m->dir[i] = NULL;
+	}
+    }
+}
+
+/*
+ * idmap_destroy - Release the map and all of its pages
+ */
+void idmap_destroy(idmap_t *m)
+{
+    idmap_page_t *pg;
+
+    idmap_clear(m);
+    while ((pg = m->pool) != NULL) {
+	m->pool = pg->next;
+	free(pg);
+    }
+    free(m->dir);
+    free(m);
+}
+
+/*
+ * idmap_add - Record the block allocated for id, bringing its page in
+ *     from the pool (or the system) if none of its ids are live
+ */
+void idmap_add(idmap_t *m, int id, char *block, size_t size)
+{
+    idmap_page_t **slot = &m->dir[id >> IDMAP_SHIFT];
+    idmap_page_t *pg = *slot;
+    idmap_ent_t *e;
+
+    if (pg == NULL) {
+	if ((pg = m->pool) != NULL)
+	    m->pool = pg->next;
+	else if ((pg = (idmap_page_t *)calloc(1, sizeof(idmap_page_t))) == NULL)
+	    idmap_error("calloc failed in idmap_add");
+	pg->live = 0;
+	*slot = pg;
+    }
+    e = &pg->ent[id & (IDMAP_PAGE-1)];
+    e->block = block;
+    e->size = size;
+    pg->live++;
+}
+
+/*
+ * idmap_remove - Forget a freed id, returning its page to the pool
+ *     once nothing in it is live
+ */
+void idmap_remove(idmap_t *m, int id)
+{
+    idmap_page_t **slot = &m->dir[id >> IDMAP_SHIFT];
+    idmap_page_t *pg = *slot;
+
+    if (pg != NULL)
+	pg->ent[id & (IDMAP_PAGE-1)].block = NULL;
+    if (pg != NULL && --pg->live == 0) {
+	pg->next = m->pool;
+	m->pool = pg;
+	*slot = NULL;
+    }
+}
+
+/*
+ * idmap_next - The first live id at or after id, or -1 if there is
+ *     none; pages with nothing live are skipped whole
+ */
+int idmap_next(idmap_t *m, int id)
+{
+    idmap_page_t *pg;
+    int i;
+
+    for (; id >= 0 && (id >> IDMAP_SHIFT) < m->npages;
+	 id = ((id >> IDMAP_SHIFT) + 1) << IDMAP_SHIFT) {
+	if ((pg = m->dir[id >> IDMAP_SHIFT]) == NULL)
+	    continue;
+	for (i = id & (IDMAP_PAGE-1); i < IDMAP_PAGE; i++)
+	    if (pg->ent[i].block != NULL)
+		return (id & ~(IDMAP_PAGE-1)) + i;
+    }
+    return -1;
+}
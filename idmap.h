@@ -0,0 +1,61 @@
+#ifndef __IDMAP_H_
+#define __IDMAP_H_
+
+/*
+ * idmap.h - Paged map from trace block ids to the blocks allocated
+ *     for them
+ *
+ * Ids are grouped into pages of IDMAP_PAGE entries. A page is allocated
+ * when the first id in it is allocated and handed back to a pool once
+ * every id in it has been freed, so memory follows the number of live
+ * blocks rather than the length of the trace. A page's entries start
+ * out, and return to, a NULL block while their ids are not live.
+ */
+#include <stddef.h>
+
+#define IDMAP_SHIFT 12
+#define IDMAP_PAGE  (1 << IDMAP_SHIFT) /* ids per page */
+
+/* One id's block and its payload size */
+typedef struct {
+    char *block;
+    size_t size;
+} idmap_ent_t;
+
+typedef struct idmap_page {
+    int live;                     /* ids in this page currently allocated */
+    struct idmap_page *next;      /* link in the pool of unused pages */
+    idmap_ent_t ent[IDMAP_PAGE];
+} idmap_page_t;
+
+typedef struct {
+    idmap_page_t **dir;  /* page for each run of IDMAP_PAGE ids, or NULL */
+    int npages;          /* entries in dir */
+    idmap_page_t *pool;  /* released pages, ready for reuse */
+} idmap_t;
+
+idmap_t *idmap_create(int num_ids);
+void idmap_destroy(idmap_t *m);
+void idmap_clear(idmap_t *m);
+
+/* Record the block allocated for id, which must not be live */
+void idmap_add(idmap_t *m, int id, char *block, size_t size);
+
+/* Forget the block of a live id once it has been freed */
+void idmap_remove(idmap_t *m, int id);
+
+/* The first live id at or after id, or -1 */
+int idmap_next(idmap_t *m, int id);
+
+/*
+ * idmap_get - The entry of a live id, or NULL if nothing in its page
+ *     is allocated. Realloc updates the entry in place.
+ */
+static inline idmap_ent_t *idmap_get(idmap_t *m, int id)
+{
+    idmap_page_t *pg = m->dir[id >> IDMAP_SHIFT];
+
+    return pg ? &pg->ent[id & (IDMAP_PAGE-1)] : NULL;
+}
+
+#endif /* __IDMAP_H_ */
@@ -0,0 +1,150 @@
+/*
+ * latency.c - Log-bucketed latency histograms
+ *
+ * A sample x below LAT_SUB has a bucket of its own. Otherwise, with
+ * e = floor(log2(x)), the top LAT_SUBBITS+1 bits of x pick one of the
+ * LAT_SUB buckets that split [2^e, 2^(e+1)).
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "latency.h"
+#include "clock.h"
+
+#define OVHD_SAMPLES 1001 /* readings used to estimate the timer overhead */
+
+/*
+ * bucket - The bucket that holds sample x
+ */
+static int bucket(uint64_t x)
+{
+    int e;
+
+    if (x < LAT_SUB)
+	return x;
+    e = 63 - __builtin_clzll(x);
+    return ((e - LAT_SUBBITS + 1) << LAT_SUBBITS) |
+	   ((x >> (e - LAT_SUBBITS)) & (LAT_SUB - 1));
+}
+
+/*
+ * bucket_top - The largest sample that falls in bucket b
+ */
+static uint64_t bucket_top(int b)
+{
+    int e;
+
+    if (b < LAT_SUB)
+	return b;
+    e = (b >> LAT_SUBBITS) + LAT_SUBBITS - 1;
+    return (((uint64_t)(LAT_SUB | (b & (LAT_SUB - 1))) + 1) << (e - LAT_SUBBITS)) - 1;
+}
+
+/*
+ * lat_clear - Empty a histogram
+ */
+void lat_clear(lat_hist_t *h)
+{
+    memset(h, 0, sizeof(lat_hist_t));
+}
+
+/*
+ * lat_add - Record one sample
+ */
+void lat_add(lat_hist_t *h, uint64_t x)
+{
+    h->count[bucket(x)]++;
+    h->n++;
+    if (x > h->max)
+	h->max = x;
+}
+
+/*
+ * lat_percentile - The sample below which a fraction p of the samples
+ *     fall, rounded up to the top of its bucket (but never above max)
+ */
+uint64_t lat_percentile(lat_hist_t *h, double p)
+{
+    uint64_t rank, seen = 0;
+    int b;
+
+    if (h->n == 0)
+	return 0;
+    rank = (uint64_t)(p * h->n);
+    if (rank >= h->n)
+	rank = h->n - 1;
+    for (b = 0; b < LAT_BUCKETS; b++) {
+	seen += h->count[b];
+	if (seen > rank)
+	    return bucket_top(b) < h->max ? bucket_top(b) : h->max;
+    }
+    return h->max;
+}
+
+/*
+ * lat_summarize - Boil a histogram down to the percentiles we print
+ */
+void lat_summarize(lat_hist_t *h, lat_summary_t *s)
+{
+    s->n = h->n;
+    s->p50 = lat_percentile(h, 0.50);
+    s->p90 = lat_percentile(h, 0.90);
+    s->p99 = lat_percentile(h, 0.99);
+    s->p999 = lat_percentile(h, 0.999);
+    s->max = h->max;
+}
+
+/*
+ * lat_size_class - The size class of a request for size bytes
+ */
+int lat_size_class(size_t size)
+{
+    int c = 0;
+
+    if (size <= 16)
+	return 0;
+    for (size = (size - 1) >> 4; size > 0 && c < LAT_CLASSES-1; size >>= 1)
+	c++;
+    return c;
+}
+
+/*
+ * lat_class_name - Label for size class c
+ */
+char *lat_class_name(int c)
+{
+    static char *names[LAT_CLASSES] = {
+	"<=16", "<=32", "<=64", "<=128", "<=256", "<=512", "<=1K",
+	"<=2K", "<=4K", "<=8K", "<=16K", "<=32K", "<=64K", ">64K"
+    };
+
+    return names[c];
+}
+
+/*
+ * cmp_u64 - qsort comparison for uint64_t
+ */
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * lat_overhead - Estimate what timing an operation adds to it: the
+ *     median gap between two back-to-back cycle_stamp calls
+ */
+uint64_t lat_overhead(void)
+{
+    uint64_t gap[OVHD_SAMPLES], t0, t1;
+    int i;
+
+    for (i = 0; i < OVHD_SAMPLES; i++) {
+	t0 = cycle_stamp();
+	t1 = cycle_stamp();
+	gap[i] = t1 - t0;
+    }
+    qsort(gap, OVHD_SAMPLES, sizeof(uint64_t), cmp_u64);
+    return gap[OVHD_SAMPLES / 2];
+}
@@ -0,0 +1,45 @@
+#ifndef __LATENCY_H_
+#define __LATENCY_H_
+
+/*
+ * latency.h - Log-bucketed latency histograms
+ *
+ * Each power of two is split into LAT_SUB buckets, so a bucket is at
+ * most 1/LAT_SUB of its lower bound wide and percentiles are accurate
+ * to about 12%, whatever the scale.
+ */
+#include <stdint.h>
+#include <stddef.h>
+
+#define LAT_SUBBITS 3
+#define LAT_SUB     (1 << LAT_SUBBITS)  /* buckets per power of two */
+#define LAT_BUCKETS (64 * LAT_SUB)
+
+/* Request size classes: <=16, <=32, ... <=64K bytes, then larger */
+#define LAT_CLASSES 14
+
+typedef struct {
+    uint64_t count[LAT_BUCKETS];
+    uint64_t n;          /* samples recorded */
+    uint64_t max;        /* largest sample */
+} lat_hist_t;
+
+/* Percentiles of one histogram, in counter ticks */
+typedef struct {
+    double n;
+    double p50, p90, p99, p999;
+    double max;
+} lat_summary_t;
+
+void lat_clear(lat_hist_t *h);
+void lat_add(lat_hist_t *h, uint64_t x);
+uint64_t lat_percentile(lat_hist_t *h, double p);
+void lat_summarize(lat_hist_t *h, lat_summary_t *s);
+
+int lat_size_class(size_t size);
+char *lat_class_name(int c);
+
+/* Ticks taken by a back-to-back pair of cycle_stamp calls */
+uint64_t lat_overhead(void);
+
+#endif /* __LATENCY_H_ */
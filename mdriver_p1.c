@@ -7,6 +7,7 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE   /* for sched_setaffinity */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -15,11 +16,30 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <stdint.h>
+#include <limits.h>
+#include <signal.h>
+#include <sched.h>
+#include <poll.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/utsname.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
 #include "config.h"
+#include "trace.h"
+#include "idmap.h"
+#include "clock.h"
+#include "latency.h"
+#include "perfctr.h"
+#include "mtreplay.h"
+#include "alloc.h"
+#include "fillcheck.h"
 
 /**********************
  * Constants and macros
@@ -27,40 +47,41 @@
 
 /* Misc */
 #define MAXLINE     1024 /* max string size */
-#define HDRLINES       4 /* number of header lines in a trace file */
-#define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+
+/* Rows of per-request latency percentiles measured with -L */
+#define LAT_ALL      0                /* every request */
+#define LAT_MALLOC   1                /* mm_malloc calls */
+#define LAT_FREE     2                /* mm_free calls */
+#define LAT_CLASS(c) (3 + (c))        /* requests in size class c */
+#define LAT_ROWS     LAT_CLASS(LAT_CLASSES)
+
+/* Long options, which have no single-letter form */
+#define OPT_JSON      256
+#define OPT_CSV       257
+#define OPT_BASELINE  258
+#define OPT_THRESHOLD 259
+#define OPT_CALIBRATE 260
+#define OPT_CALFILE   261
+#define OPT_HEAPFILE  262
+
+#define CSV_FIELDS  128  /* most columns in a --csv row */
+#define ALLOC_MAX   8    /* most engines one run can evaluate (-a) */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
 
 /****************************** 
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
-typedef struct range_t {
-    char *lo;              /* low payload address */
-    char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
-} range_t;
-
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
-
-/* Holds the information for one trace file*/
+/* Records the extent of every block's payload: one bit per ALIGNMENT-byte
+   granule of the heap, set while the granule is part of a payload */
 typedef struct {
-    int sugg_heapsize;   /* suggested heap size (unused) */
-    int num_ids;         /* number of alloc/realloc ids */
-    int num_ops;         /* number of distinct requests */
-    int weight;          /* weight for this trace (unused) */
-    traceop_t *ops;      /* array of requests */
-    char **blocks;       /* array of ptrs returned by malloc/realloc... */
-    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
-} trace_t;
+    char *base;            /* heap address of granule 0 */
+    uint64_t *bits;        /* the bitmap */
+    size_t nbytes;         /* size of the bitmap mapping */
+    size_t nwords_used;    /* words that may have bits set */
+} shadow_t;
 
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
@@ -68,23 +89,56 @@ typedef struct {
  * as input.
  */
 typedef struct {
-    trace_t *trace;  
-    range_t *ranges;
+    allocator_t *alloc;      /* the engine being timed */
+    trace_stream_t *stream;  /* the trace */
+    idmap_t *ids;            /* its blocks */
+    double stall;            /* secs the runs spent waiting on the decoder,
+				or freeing what the last run left live */
+    int runs;                /* number of runs fsecs made */
 } speed_t;
 
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
-    /* defined for both libc malloc and student malloc package (mm.c) */
+    /* defined for every engine */
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
 
-    /* defined only for the student malloc package */
-    double util;     /* space utilization for this trace (always 0 for libc) */
+    /* defined only for engines with a heap we can see, like mm.c, and
+       for the first engine, which the perf index is computed for */
+    double util;     /* space utilization for this trace (0 without a heap) */
+    double thp_secs; /* secs to run the trace on a huge page heap (-H) */
+    lat_summary_t lat[LAT_ROWS]; /* per-request latency, in ticks (-L) */
+    fsecs_dist_t dist; /* spread of the timed runs behind secs (-R) */
+    pc_counts_t pc;    /* event counts per op over one run (-P) */
+    mm_search_t search; /* mm.c's search costs over one run (-s) */
+    int resumed;       /* resumed intact on a heap file (--heap-file) */
+#ifdef MM_PROFILE
+    mm_profile_t prof; /* mm.c's phase times over the timed runs */
+#endif
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* The aggregate results behind the perf index */
+typedef struct {
+    int correct;        /* traces the mm package processed correctly */
+    double util;        /* average utilization over the traces */
+    double thruput;     /* ops/sec over all of the traces */
+    double util_score;  /* the two parts of the perf index, out of 100 */
+    double thru_score;
+    double perfindex;
+    double thru_ref;    /* ops/sec at which the throughput score is capped */
+    double thru_raw;    /* thruput as a percentage of thru_ref, uncapped */
+} summary_t;
+
+/* What a -j worker sends back for each trace it evaluates */
+typedef struct {
+    int tracenum;    /* which trace */
+    int errors;      /* errors found while evaluating it */
+    stats_t stats[ALLOC_MAX]; /* results for each engine, in -a order */
+} job_result_t;
+
 /********************
  * Global variables
  *******************/
@@ -101,35 +155,92 @@ static char *default_tracefiles[] = {
 };
 
 static int foption = 0;
+static allocator_t *engines[ALLOC_MAX]; /* engines to evaluate (-a, -l); */
+static int num_engines = 0;             /*   the first is scored */
+static int thp_compare = 0; /* If set, rerun with huge pages and compare (-H) */
+static int window = INT_MAX;/* Ops per replay window (STREAM_WINDOW with -S) */
+static int latency = 0;     /* If set, measure per-request latency (-L) */
+static uint64_t lat_ovhd;   /* timer overhead taken off each latency sample */
+static int robust = 0;      /* If set, time by median with a CI target (-R) */
+static int counters = 0;    /* If set, count CPU events per op (-P) */
+static int search = 0;      /* If set, report mm.c's search costs (-s) */
+static int verify = 0;      /* If set, check payloads are intact (-c) */
+static int frag_interval = 0;/* If set, sample the heap this often (-F) */
+static int mt_threads = 0;  /* If set, replay on 1..mt_threads threads (-T) */
+static pthread_mutex_t mt_lock = PTHREAD_MUTEX_INITIALIZER; /* for -T */
+static allocator_t *mt_engine;     /* the engine behind mt_lock */
+static char *json_file = NULL;    /* write results as JSON here (--json) */
+static char *csv_file = NULL;     /* write results as CSV here (--csv) */
+static FILE *results_out = NULL;  /* the real stdout, when a results
+				     file is "-" */
+static char *baseline_file = NULL;/* compare with these CSV results (--baseline) */
+static double threshold = REGRESS_THRESHOLD; /* (--threshold) */
+static int calibrate = 0;         /* measure libc's throughput (--calibrate) */
+static char *cal_file = CALIBRATION_FILE; /* where it is kept (--calibration) */
+static char *heap_file = NULL;    /* resume traces on a heap here (--heap-file) */
+static char cmdline[MAXLINE];     /* how we were run, for the metadata */
 
 
 /********************* 
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
-static int add_range(range_t **ranges, char *lo, int size, 
+/* these functions manipulate the shadow bitmap of payload extents */
+static int add_range(allocator_t *a, shadow_t *shadow, char *lo, size_t size,
 		     int tracenum, int opnum);
-static void remove_range(range_t **ranges, char *lo);
-static void clear_ranges(range_t **ranges);
-
-/* These functions read, allocate, and free storage for traces */
-static trace_t *read_trace(char *tracedir, char *filename);
-static void free_trace(trace_t *trace);
-
-/* Routines for evaluating the correctness and speed of libc malloc */
-static int eval_libc_valid(trace_t *trace, int tracenum);
-static void eval_libc_speed(void *ptr);
+static int remove_range(shadow_t *shadow, char *lo, size_t size,
+			int tracenum, int opnum);
+static void clear_ranges(allocator_t *a, shadow_t *shadow);
+static int check_fill(idmap_ent_t *e, int index, int tracenum, int opnum,
+		      char *when);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
-   of the student's malloc package in mm.c */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+   of an allocator engine, such as the student's malloc package in mm.c */
+static int eval_mm_valid(allocator_t *a, trace_stream_t *stream,
+			 idmap_t *ids, int tracenum, shadow_t *shadow);
+static double eval_mm_util(allocator_t *a, trace_stream_t *stream,
+			   idmap_t *ids, int tracenum);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_frag(allocator_t *a, trace_stream_t *stream, 
+			 idmap_t *ids, FILE *fp);
+static int eval_mm_resume(allocator_t *a, trace_stream_t *stream,
+			  idmap_t *ids, int tracenum, char *path);
+static double time_speed(fsecs_test_funct f, speed_t *params,
+			 fsecs_dist_t *dist);
+static void eval_mm_latency(allocator_t *a, trace_stream_t *stream, 
+			    idmap_t *ids, lat_hist_t *hists);
+
+/* Routines that run the evaluation over all of the traces */
+static void run_passes(char **tracefiles, int n, stats_t **stats);
+static void run_workers(char **tracefiles, int n, int jobs, stats_t **stats);
+static void run_threads(char **tracefiles, int n, stats_t **stats);
 
 /* Various helper routines */
+static void add_engine(char *name);
 static void printresults(int n, stats_t *stats);
+static void printcompare(int n, stats_t **stats);
+static void printthp(int n, stats_t *stats);
+static void printlatency(int n, stats_t *stats);
+static void printdist(int n, stats_t *stats);
+static void printcounters(int n, stats_t *stats);
+static void printsearch(int n, stats_t *stats);
+#ifdef MM_PROFILE
+static void printprofile(int n, stats_t *stats);
+#endif
+static void results_to_stdout(void);
+static void write_json(char *path, char **tracefiles, int n, 
+		       stats_t **stats, summary_t *sum);
+static void write_csv(char *path, char **tracefiles, int n, 
+		      stats_t **stats, summary_t *sum);
+static int compare_baseline(char *path, char **tracefiles, int n,
+			    stats_t *mm_stats);
+static double calibrate_libc(char **tracefiles, int n);
+static void write_calibration(char *path, char **tracefiles, int n,
+			      double thruput);
+static double read_calibration(char *path, char **tracefiles, int n);
+static int getmeta(char *keys[], char vals[][MAXLINE], int max);
 static void usage(void);
+static size_t parse_size(char *str);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
 static void app_error(char *msg);
@@ -139,28 +250,48 @@ static void app_error(char *msg);
  **************/
 int main(int argc, char **argv)
 {
-    int i;
-    char c;
+    int i, c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
-    trace_t *trace = NULL;     /* stores a single trace file in memory */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
-    stats_t *libc_stats = NULL;/* libc stats for each trace */
-    stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
-    speed_t speed_params;      /* input parameters to the xx_speed routines */ 
+    stats_t *stats[ALLOC_MAX]; /* each engine's stats for each trace */
+    stats_t *mm_stats;         /* those of the first engine, which is scored */
+    char *name;
 
     //int team_check = 1;  /* If set, check team structure (reset by -a) */
-    int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int jobs = 1;        /* Number of worker processes (set by -j) */
+    int regressed = 0;   /* Set if we're worse than the --baseline */
+    int libc = 0;        /* If set, run libc malloc as well (-l) */
+    int reported = 0;    /* Set once a report on mm.c itself is printed */
+    int tried, resumed;  /* traces tried and resumed with --heap-file */
+    summary_t summary;
+    static struct option longopts[] = {
+	{"json",      required_argument, NULL, OPT_JSON},
+	{"csv",       required_argument, NULL, OPT_CSV},
+	{"baseline",  required_argument, NULL, OPT_BASELINE},
+	{"threshold", required_argument, NULL, OPT_THRESHOLD},
+	{"calibrate", no_argument,       NULL, OPT_CALIBRATE},
+	{"calibration", required_argument, NULL, OPT_CALFILE},
+	{"heap-file", required_argument, NULL, OPT_HEAPFILE},
+	{NULL, 0, NULL, 0}
+    };
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
+    double thru_ref;     /* ops/sec that earns the full throughput score */
     int numcorrect;
     
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    for (i = 0; i < argc; i++) {
+	if (strlen(cmdline) + strlen(argv[i]) + 2 > sizeof(cmdline))
+	    break;
+	strcat(cmdline, i ? " " : "");
+	strcat(cmdline, argv[i]);
+    }
+    while ((c = getopt_long(argc, argv, "a:cf:t:hvVglF:HLM:PsST:j:RW:",
+			    longopts, NULL)) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -181,12 +312,87 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
-        /* BSK: no teams */
-        //case 'a': /* Don't check team structure */
-        //    team_check = 0;
-        //    break;
-        case 'l': /* Run libc malloc */
-            run_libc = 1;
+        case 'a': /* Evaluate these engines, the first one scored */
+            for (name = strtok(optarg, ","); name; name = strtok(NULL, ","))
+                add_engine(name);
+            break;
+        case 'c': /* Check each payload's fill before it is freed */
+            verify = 1;
+            break;
+        case 'l': /* Run libc malloc as well */
+            libc = 1;
+            break;
+        case 'F': /* Write a fragmentation timeline for each trace */
+            if ((frag_interval = atoi(optarg)) < 1) {
+                sprintf(msg, "Bad fragmentation sampling interval: %s", optarg);
+                app_error(msg);
+            }
+            break;
+        case 'H': /* Compare throughput with and without huge pages */
+            thp_compare = 1;
+            break;
+        case 'M': /* Size of the simulated heap */
+            mem_set_max_heap(parse_size(optarg));
+            break;
+        case 'L': /* Measure the latency of each request */
+            latency = 1;
+            break;
+        case 'P': /* Count hardware events around eval_mm_speed */
+            counters = 1;
+            break;
+        case 's': /* Report how far mm.c searches and how often it merges */
+            search = 1;
+            break;
+        case 'S': /* Stream traces in windows instead of loading them */
+            window = STREAM_WINDOW;
+            break;
+        case 'T': /* Replay each trace on 1..n threads */
+            if ((mt_threads = atoi(optarg)) < 1 || mt_threads > MT_MAX_WORKERS) {
+                sprintf(msg, "Bad number of threads: %s (at most %d)",
+			optarg, MT_MAX_WORKERS);
+                app_error(msg);
+            }
+            break;
+        case 'j': /* Evaluate traces in parallel worker processes */
+            if ((jobs = atoi(optarg)) < 1) {
+                sprintf(msg, "Bad number of jobs: %s", optarg);
+                app_error(msg);
+            }
+            break;
+        case 'R': /* Time by the median of runs until its CI is tight */
+            robust = 1;
+            break;
+        case 'W': /* Warmup runs before each -R measurement */
+            if ((i = atoi(optarg)) < 0) {
+                sprintf(msg, "Bad number of warmup runs: %s", optarg);
+                app_error(msg);
+            }
+            set_fsecs_warmup(i);
+            break;
+        case OPT_JSON: /* Write every result as JSON */
+            json_file = optarg;
+            break;
+        case OPT_CSV: /* Write every result as CSV */
+            csv_file = optarg;
+            break;
+        case OPT_BASELINE: /* Compare with the CSV results of another run */
+            baseline_file = optarg;
+            robust = 1; /* judge throughput by a measured spread */
+            break;
+        case OPT_THRESHOLD: /* Regression that fails the comparison, in % */
+            if ((threshold = atof(optarg) / 100) <= 0) {
+                sprintf(msg, "Bad regression threshold: %s", optarg);
+                app_error(msg);
+            }
+            break;
+        case OPT_CALIBRATE: /* Measure libc's throughput on this host */
+            calibrate = 1;
+            break;
+        case OPT_CALFILE: /* Keep that measurement in this file */
+            cal_file = optarg;
+            break;
+        case OPT_HEAPFILE: /* Check mm resumes a heap kept in this file */
+            heap_file = optarg;
             break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
@@ -230,6 +436,11 @@ int main(int argc, char **argv)
 	//    printf("Member 2 :%s:%s\n", team.name2, team.id2);
     //}
 
+    /* Keep stdout for a results file written there, so it can be piped */
+    if ((json_file && !strcmp(json_file, "-")) ||
+	(csv_file && !strcmp(csv_file, "-")))
+	results_to_stdout();
+
     /* 
      * If no -f command line arg, then use the entire set of tracefiles 
      * defined in default_traces[]
@@ -240,87 +451,139 @@ int main(int argc, char **argv)
 	printf("Using default tracefiles in %s\n", tracedir);
     }
 
+    /* Without -a, the student's mm package is the one scored */
+    if (num_engines == 0)
+	add_engine("mm");
+    if (libc)
+	add_engine("libc");
+    if ((thp_compare || frag_interval || heap_file) && !engines[0]->heap)
+	printf("Warning: %s has no heap to measure, so -H, -F and "
+	       "--heap-file are ignored\n", engines[0]->desc);
+    if (heap_file && jobs > 1)
+	printf("Warning: the workers can't share one heap file, so "
+	       "--heap-file is ignored with -j\n");
+
     /* Initialize the timing package */
     init_fsecs();
 
-    /*
-     * Optionally run and evaluate the libc malloc package 
-     */
-    if (run_libc) {
-	if (verbose > 1)
-	    printf("\nTesting libc malloc\n");
-	
-	/* Allocate libc stats array, with one stats_t struct per tracefile */
-	libc_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-	if (libc_stats == NULL)
-	    unix_error("libc_stats calloc in main failed");
-	
-	/* Evaluate the libc malloc package using the K-best scheme */
-	for (i=0; i < num_tracefiles; i++) {
-	    trace = read_trace(tracedir, tracefiles[i]);
-	    libc_stats[i].ops = trace->num_ops;
-	    if (verbose > 1)
-		printf("Checking libc malloc for correctness, ");
-	    libc_stats[i].valid = eval_libc_valid(trace, i);
-	    if (libc_stats[i].valid) {
-		speed_params.trace = trace;
-		if (verbose > 1)
-		    printf("and performance.\n");
-		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
-	    }
-	    free_trace(trace);
-	}
-
-	/* Display the libc results in a compact table */
-	if (verbose) {
-	    printf("\nResults for libc malloc:\n");
-	    printresults(num_tracefiles, libc_stats);
-	}
+    /* Find the throughput that earns the full score: libc's on this
+       host, measured now or by an earlier --calibrate */
+    if (calibrate) {
+	thru_ref = calibrate_libc(tracefiles, num_tracefiles);
+	write_calibration(cal_file, tracefiles, num_tracefiles, thru_ref);
+	printf("libc malloc ran these traces at %.0f Kops/sec; saved to %s\n",
+	       thru_ref/1e3, cal_file);
     }
+    else if ((thru_ref = read_calibration(cal_file, tracefiles,
+					  num_tracefiles)) > 0)
+	printf("Scoring throughput against libc malloc's %.0f Kops/sec "
+	       "from %s\n", thru_ref/1e3, cal_file);
+    else
+	thru_ref = AVG_LIBC_THRUPUT;
+
+    /* Estimate the cost of a timestamp, to take off latency samples */
+    if (latency)
+	lat_ovhd = lat_overhead();
+
+    /* Allocate the stats arrays, with one stats_t struct per tracefile */
+    for (i = 0; i < num_engines; i++)
+	if ((stats[i] = (stats_t *)calloc(num_tracefiles, 
+					  sizeof(stats_t))) == NULL)
+	    unix_error("stats calloc in main failed");
+    mm_stats = stats[0];
 
     /*
-     * Always run and evaluate the student's mm package
+     * Evaluate every engine on every trace, either right here or
+     * spread over -j workers
      */
-    if (verbose > 1)
-	printf("\nTesting mm malloc\n");
-
-    /* Allocate the mm stats array, with one stats_t struct per tracefile */
-    mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-    if (mm_stats == NULL)
-	unix_error("mm_stats calloc in main failed");
-    
-    /* Initialize the simulated memory system in memlib.c */
-    mem_init(); 
+    if (jobs > 1)
+	run_workers(tracefiles, num_tracefiles, jobs, stats);
+    else
+	run_passes(tracefiles, num_tracefiles, stats);
 
-    /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+    /* Display the results in compact tables */
+    if (verbose) {
+	for (i = 0; i < num_engines; i++) {
+	    printf("\nResults for %s:\n", engines[i]->desc);
+	    printresults(num_tracefiles, stats[i]);
 	}
-	free_trace(trace);
+	printf("\n");
     }
-
-    /* Display the mm results in a compact table */
-    if (verbose) {
-	printf("\nResults for mm malloc:\n");
-	printresults(num_tracefiles, mm_stats);
+    if (num_engines > 1) {
+	printf("%sSide-by-side results, relative to %s:\n", 
+	       verbose ? "" : "\n", engines[0]->desc);
+	printcompare(num_tracefiles, stats);
+	printf("\n");
+    }
+    if (heap_file && engines[0]->heap && jobs == 1) {
+	for (i = 0, tried = 0, resumed = 0; i < num_tracefiles; i++) {
+	    tried += mm_stats[i].valid;
+	    resumed += mm_stats[i].resumed;
+	}
+	printf("%s%s resumed %d of %d valid traces intact on a heap "
+	       "attached again from %s\n\n", 
+	       verbose || num_engines > 1 ? "" : "\n", engines[0]->desc, 
+	       resumed, tried, heap_file);
+    }
+    if (thp_compare && engines[0]->heap) {
+	printf("%sHuge page comparison for %s:\n", 
+	       verbose || num_engines > 1 ? "" : "\n", engines[0]->desc);
+	printthp(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (latency) {
+	printf("%sLatency of %s requests, in counter ticks "
+	       "(timer overhead of %lu ticks subtracted):\n",
+	       verbose || num_engines > 1 || thp_compare ? "" : "\n", 
+	       engines[0]->desc, (unsigned long)lat_ovhd);
+	printlatency(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (robust) {
+	printf("%sDistribution of timed runs of %s (usecs):\n",
+	       verbose || num_engines > 1 || thp_compare || latency ? "" : "\n",
+	       engines[0]->desc);
+	printdist(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (counters) {
+	if (!(verbose || num_engines > 1 || thp_compare || latency || robust))
+	    printf("\n");
+	printcounters(num_tracefiles, mm_stats);
 	printf("\n");
     }
+    for (i = 0; search && i < num_engines; i++) {
+	if (strcmp(engines[i]->name, "mm") != 0)
+	    continue;
+	printf("%sFree-list searches and coalescing of %s:\n",
+	       verbose || num_engines > 1 || thp_compare || latency || robust ||
+	       counters ? "" : "\n", engines[i]->desc);
+	printsearch(num_tracefiles, stats[i]);
+	printf("\n");
+	reported = 1;
+    }
+#ifdef MM_PROFILE
+    for (i = 0; i < num_engines; i++) {
+	if (strcmp(engines[i]->name, "mm") != 0)
+	    continue;
+	printf("%sTime in the phases of %s, in counter ticks:\n",
+	       verbose || num_engines > 1 || thp_compare || latency || robust ||
+	       counters || reported ? "" : "\n", engines[i]->desc);
+	printprofile(num_tracefiles, stats[i]);
+	printf("\n");
+	reported = 1;
+    }
+#endif
+    if (mt_threads) {
+	if (!(verbose || num_engines > 1 || thp_compare || latency || robust ||
+	      counters || reported))
+	    printf("\n");
+	run_threads(tracefiles, num_tracefiles, stats);
+    }
 
     /* 
-     * Accumulate the aggregate statistics for the student's mm package 
+     * Accumulate the aggregate statistics for the first engine, by
+     * default the student's mm package
      */
     secs = 0;
     ops = 0;
@@ -348,12 +611,12 @@ int main(int argc, char **argv)
         p1 = ((double) UTIL_WEIGHT) *
         (avg_mm_util/MAX_UTIL);
     }
-	if (avg_mm_throughput > AVG_LIBC_THRUPUT) {
+	if (avg_mm_throughput > thru_ref) {
 	    p2 = (double)(1.0 - UTIL_WEIGHT);
 	} 
 	else {
 	    p2 = ((double) (1.0 - UTIL_WEIGHT)) * 
-		(avg_mm_throughput/AVG_LIBC_THRUPUT);
+		(avg_mm_throughput/thru_ref);
 	}
 	
 	perfindex = (p1 + p2)*100.0;
@@ -361,9 +624,12 @@ int main(int argc, char **argv)
 	       p1*100, 
 	       p2*100, 
 	       perfindex);
+	printf("Raw thru score = %.0f (uncapped; 100 is %.0f Kops/sec)\n",
+	       100 * avg_mm_throughput / thru_ref, thru_ref/1e3);
 	
     }
     else { /* There were errors */
+	avg_mm_throughput = p1 = p2 = 0.0;
 	perfindex = 0.0;
 	printf("Terminated with %d errors\n", errors);
     }
@@ -373,27 +639,60 @@ int main(int argc, char **argv)
 	printf("perfidx:%.0f\n", perfindex);
     }
 
-    exit(0);
+    /*
+     * Save the results in machine-readable form and compare them
+     * with an earlier run
+     */
+    summary.correct = numcorrect;
+    summary.util = avg_mm_util;
+    summary.thruput = avg_mm_throughput;
+    summary.util_score = p1*100;
+    summary.thru_score = p2*100;
+    summary.perfindex = perfindex;
+    summary.thru_ref = thru_ref;
+    summary.thru_raw = 100 * avg_mm_throughput / thru_ref;
+    if (json_file)
+	write_json(json_file, tracefiles, num_tracefiles, stats, &summary);
+    if (csv_file)
+	write_csv(csv_file, tracefiles, num_tracefiles, stats, &summary);
+    if (baseline_file)
+	regressed = compare_baseline(baseline_file, tracefiles,
+				     num_tracefiles, mm_stats);
+
+    for (i = 0; i < num_engines; i++)
+	free(stats[i]);
+    exit(regressed ? 2 : 0);
 }
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the shadow bitmap, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * shadow bitmap to detect any overlapping allocated blocks. Payloads
+ * start on ALIGNMENT boundaries, so two payloads overlap exactly when
+ * they share a granule, and each check costs time proportional to the
+ * payload size rather than to the number of live blocks.
  ****************************************************************/
 
+/* Mask of the bits of word w that fall in granules [g0, g1] */
+#define SHADOW_MASK(w, g0, g1) \
+    ((((w) == (g0)/64) ? ~0ULL << ((g0) % 64) : ~0ULL) & \
+     (((w) == (g1)/64) ? ~0ULL >> (63 - (g1) % 64) : ~0ULL))
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
- *     we've just called the student's mm_malloc to allocate a block of 
+ *     we've just called the engine's malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we mark the granules of its payload in the shadow bitmap. Only
+ *     the alignment can be checked for an engine without a heap.
  */
-static int add_range(range_t **ranges, char *lo, int size, 
+static int add_range(allocator_t *a, shadow_t *shadow, char *lo, size_t size,
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    size_t g0, g1, w;
+    uint64_t hits;
+    alloc_stats_t st;
     char msg[MAXLINE];
 
     assert(size > 0);
@@ -406,227 +705,250 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
+    if (shadow->base == NULL)
+	return 1;
+
     /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    a->stats(&st, 0);
+    if ((lo < st.heap_lo) || (lo > st.heap_hi) || 
+	(hi < st.heap_lo) || (hi > st.heap_hi)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
-		lo, hi, mem_heap_lo(), mem_heap_hi());
+		lo, hi, st.heap_lo, st.heap_hi);
 	malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
     /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
+    g0 = (lo - shadow->base) / ALIGNMENT;
+    g1 = (hi - shadow->base) / ALIGNMENT;
+    for (w = g0/64; w <= g1/64; w++) {
+	if ((hits = shadow->bits[w] & SHADOW_MASK(w, g0, g1)) != 0) {
+	    sprintf(msg, "Payload (%p:%p) overlaps another payload at %p\n",
+		    lo, hi, 
+		    shadow->base + (w*64 + __builtin_ctzll(hits)) * ALIGNMENT);
 	    malloc_error(tracenum, opnum, msg);
 	    return 0;
-        }
+	}
     }
 
-    /* 
-     * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
-     */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
-    p->lo = lo;
-    p->hi = hi;
-    *ranges = p;
+    /* Everything looks OK, so remember the extent of this block */
+    for (w = g0/64; w <= g1/64; w++)
+	shadow->bits[w] |= SHADOW_MASK(w, g0, g1);
+    if (g1/64 >= shadow->nwords_used)
+	shadow->nwords_used = g1/64 + 1;
     return 1;
 }
 
 /* 
- * remove_range - Free the range record of block whose payload starts at lo 
+ * remove_range - As directed by request opnum in trace tracenum, clear
+ *     the granules of the size-byte payload at lo, which must lie in
+ *     the part of the heap the bitmap covers
  */
-static void remove_range(range_t **ranges, char *lo)
+static int remove_range(shadow_t *shadow, char *lo, size_t size,
+			int tracenum, int opnum)
 {
-    range_t *p;
-    range_t **prevpp = ranges;
-    //int size;
+    size_t g0, g1, w;
+    size_t span = shadow->nbytes * 8 * ALIGNMENT; /* heap bytes covered */
+    char msg[MAXLINE];
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            //size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    if (shadow->base == NULL)
+	return 1;
+    if (lo == NULL || lo < shadow->base || size > span ||
+	(size_t)(lo - shadow->base) > span - size) {
+	sprintf(msg, "Freed payload (%p, %lu bytes) lies outside the heap",
+		lo, (unsigned long)size);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
+    g0 = (lo - shadow->base) / ALIGNMENT;
+    g1 = (lo + size - 1 - shadow->base) / ALIGNMENT;
+    for (w = g0/64; w <= g1/64; w++)
+	shadow->bits[w] &= ~SHADOW_MASK(w, g0, g1);
+    return 1;
 }
 
 /*
- * clear_ranges - free all of the range records for a trace 
+ * clear_ranges - empty the shadow bitmap for a new trace, (re)creating
+ *     it if the engine's heap has moved since it was last used. For an
+ *     engine without a heap, the base is NULL and nothing is tracked.
  */
-static void clear_ranges(range_t **ranges)
+static void clear_ranges(allocator_t *a, shadow_t *shadow)
 {
-    range_t *p;
-    range_t *pnext;
+    alloc_stats_t st;
+    size_t nbytes;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
+    if (!a->heap) {
+	shadow->base = NULL;
+	return;
+    }
+    a->stats(&st, 0);
+    if (shadow->base == st.heap_lo) {
+	memset(shadow->bits, 0, shadow->nwords_used * sizeof(uint64_t));
+	shadow->nwords_used = 0;
+	return;
     }
-    *ranges = NULL;
-}
 
+    /* One bit per granule of the largest possible heap. The mapping is
+       zero-filled on demand, so untouched parts cost nothing. */
+    if (shadow->bits != NULL)
+	munmap(shadow->bits, shadow->nbytes);
+    nbytes = ((st.heap_max / ALIGNMENT + 63) / 64) * sizeof(uint64_t);
+    shadow->bits = mmap(NULL, nbytes, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (shadow->bits == MAP_FAILED)
+	unix_error("mmap error in clear_ranges");
+    shadow->base = st.heap_lo;
+    shadow->nbytes = nbytes;
+    shadow->nwords_used = 0;
+}
 
-/**********************************************
- * The following routines manipulate tracefiles
- *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * check_fill - With -c, check that a live block still holds the low
+ *     byte of its id, as eval_mm_valid filled it; returns 0 and reports
+ *     the first byte that doesn't if some part of it was overwritten
  */
-static trace_t *read_trace(char *tracedir, char *filename)
+static int check_fill(idmap_ent_t *e, int index, int tracenum, int opnum,
+		      char *when)
 {
-    FILE *tracefile;
-    trace_t *trace;
-    char type[MAXLINE];
-    char path[MAXLINE];
-    unsigned index, size;
-    unsigned max_index = 0;
-    unsigned op_index;
+    size_t off = fill_check(e->block, index & 0xFF, e->size);
+
+    if (off == e->size)
+	return 1;
+    sprintf(msg, "Payload of block %d (%lu bytes at %p) was overwritten "
+	    "at offset %lu, found %s: 0x%02x where 0x%02x was written.",
+	    index, (unsigned long)e->size, e->block, (unsigned long)off, when,
+	    (unsigned char)e->block[off], index & 0xFF);
+    malloc_error(tracenum, opnum, msg);
+    return 0;
+}
 
-    if (verbose > 1)
-	printf("Reading tracefile: %s\n", filename);
+/*
+ * freed_block - The entry of the block a trace frees, or NULL, reported
+ *     as an error in the trace, if its id isn't allocated
+ */
+static idmap_ent_t *freed_block(idmap_t *ids, int index, int tracenum,
+				int opnum)
+{
+    idmap_ent_t *e = idmap_get(ids, index);
 
-    /* Allocate the trace record */
-    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
-	unix_error("malloc 1 failed in read_trance");
-	
-    /* Read the trace file header */
-    strcpy(path, tracedir);
-    strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
-	sprintf(msg, "Could not open %s in read_trace", path);
-	unix_error(msg);
+    if (e == NULL || e->block == NULL) {
+	sprintf(msg, "Free of block %d, which is not allocated.", index);
+	malloc_error(tracenum, opnum, msg);
+	return NULL;
     }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));     
-    fscanf(tracefile, "%d", &(trace->num_ops));     
-    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
-    
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
-
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks = 
-	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-	unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes = 
-	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-	unix_error("malloc 4 failed in read_trace");
-    
-    /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-	switch(type[0]) {
-	case 'a':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = ALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'r':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = REALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'f':
-	    fscanf(tracefile, "%ud", &index);
-	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
-	    break;
-	default:
-	    printf("Bogus type character (%c) in tracefile %s\n", 
-		   type[0], path);
-	    exit(1);
-	}
-	op_index++;
-	
+    return e;
+}
+
+
+/**********************************************************************
+ * The following functions evaluate the correctness, space utilization,
+ * and throughput of an allocator engine, calling it only through its
+ * allocator_t. Each makes one pass over its trace, a window of ops at
+ * a time.
+ **********************************************************************/
+
+/*
+ * free_live - Free every block the last pass over a trace left live,
+ *     for an engine that can't drop its blocks wholesale
+ */
+static void free_live(allocator_t *a, idmap_t *ids)
+{
+    int id;
+
+    for (id = idmap_next(ids, 0); id >= 0; id = idmap_next(ids, id + 1)) {
+	a->free(idmap_get(ids, id)->block);
+	idmap_remove(ids, id);
     }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
-    
-    return trace;
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ * stop_engine - Forget the blocks an engine's last pass left live. An
+ *     engine without a reset has them freed one at a time, so that
+ *     passes don't pile up; the id map is then empty for the next
+ *     engine, which must not be handed this one's blocks.
  */
-void free_trace(trace_t *trace)
+static void stop_engine(allocator_t *a, idmap_t *ids)
 {
-    free(trace->ops);         /* free the three arrays... */
-    free(trace->blocks);      
-    free(trace->block_sizes);
-    free(trace);              /* and the trace record itself... */
+    if (a->reset == NULL)
+	free_live(a, ids);
+    idmap_clear(ids);
 }
 
-/**********************************************************************
- * The following functions evaluate the correctness, space utilization,
- * and throughput of the libc and mm malloc packages.
- **********************************************************************/
+/*
+ * start_engine - Give an engine an empty heap for a new pass over a
+ *     trace
+ */
+static int start_engine(allocator_t *a, idmap_t *ids)
+{
+    stop_engine(a, ids);
+    if (a->reset != NULL)
+	a->reset();
+    return a->init();
+}
 
 /*
- * eval_mm_valid - Check the mm malloc package for correctness
+ * now_secs - Read the monotonic clock
  */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
+static double now_secs(void)
 {
-    int i;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * eval_mm_valid - Check an engine, by default the mm malloc package,
+ *     for correctness
+ */
+static int eval_mm_valid(allocator_t *a, trace_stream_t *stream,
+			 idmap_t *ids, int tracenum, shadow_t *shadow) 
+{
+    int i, n, opnum;
     //int j;
     int index;
-    int size;
-    //int oldsize;
+    size_t size;
+    //size_t oldsize;
     //char *newp;
     //char *oldp;
     char *p;
+    traceop_t *ops;
+    idmap_ent_t *e;
     
-    /* Reset the heap and free any records in the range list */
-    mem_reset_brk();
-    clear_ranges(ranges);
-
-    /* Call the mm package's init function */
-    if (mm_init() < 0) {
-	malloc_error(tracenum, 0, "mm_init failed.");
+    /* Reset the heap, the id map and the shadow bitmap, and call the
+       engine's init function */
+    if (start_engine(a, ids) < 0) {
+	sprintf(msg, "%s_init failed.", a->name);
+	malloc_error(tracenum, 0, msg);
 	return 0;
     }
+    clear_ranges(a, shadow);
 
     /* Interpret each operation in the trace in order */
-    for (i = 0;  i < trace->num_ops;  i++) {
-	index = trace->ops[i].index;
-	size = trace->ops[i].size;
+    trace_stream_rewind(stream);
+    for (opnum = 0; (n = trace_stream_next(stream, &ops)) > 0; opnum += n) {
+      for (i = 0;  i < n;  i++) {
+	index = ops[i].index;
+	size = ops[i].size;
 
-        switch (trace->ops[i].type) {
+        switch (ops[i].type) {
 
         case ALLOC: /* mm_malloc */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
-		malloc_error(tracenum, i, "mm_malloc failed.");
+	    if ((p = a->malloc(size)) == NULL) {
+		sprintf(msg, "%s_malloc failed.", a->name);
+		malloc_error(tracenum, opnum+i, msg);
 		return 0;
 	    }
 	    
 	    /* 
 	     * Test the range of the new block for correctness and add it 
-	     * to the range list if OK. The block must be  be aligned properly,
+	     * to the shadow bitmap if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
-	    if (add_range(ranges, p, size, tracenum, i) == 0)
+	    if (add_range(a, shadow, p, size, tracenum, opnum+i) == 0)
 		return 0;
 	    
 	    /* ADDED: cgw
@@ -637,25 +959,25 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    memset(p, index & 0xFF, size);
 
 	    /* Remember region */
-	    trace->blocks[index] = p;
-	    trace->block_sizes[index] = size;
+	    idmap_add(ids, index, p, size);
 	    break;
 
         /* BSK: not considering realloc */
         //case REALLOC: /* mm_realloc */
 	    //
 	    ///* Call the student's realloc */
-	    //oldp = trace->blocks[index];
+	    //e = idmap_get(ids, index);
+	    //oldp = e->block;
 	    //if ((newp = mm_realloc(oldp, size)) == NULL) {
-		//malloc_error(tracenum, i, "mm_realloc failed.");
+		//malloc_error(tracenum, opnum+i, "mm_realloc failed.");
 		//return 0;
 	    //}
 	    //
-	    ///* Remove the old region from the range list */
-	    //remove_range(ranges, oldp);
+	    ///* Remove the old region from the shadow bitmap */
+	    //remove_range(shadow, oldp, e->size);
 	    //
-	    ///* Check new block for correctness and add it to range list */
-	    //if (add_range(ranges, newp, size, tracenum, i) == 0)
+	    ///* Check new block for correctness and add it to the bitmap */
+	    //if (add_range(shadow, newp, size, tracenum, opnum+i) == 0)
 		//return 0;
 	    //
 	    ///* ADDED: cgw
@@ -663,11 +985,11 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    // * block and then fill in the new block with the low order byte
 	    // * of the new index
 	    // */
-	    //oldsize = trace->block_sizes[index];
+	    //oldsize = e->size;
 	    //if (size < oldsize) oldsize = size;
 	    //for (j = 0; j < oldsize; j++) {
 	    //  if (newp[j] != (index & 0xFF)) {
-		//malloc_error(tracenum, i, "mm_realloc did not preserve the "
+		//malloc_error(tracenum, opnum+i, "mm_realloc did not preserve the "
 		//	     "data from old block");
 		//return 0;
 	    //  }
@@ -675,22 +997,37 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    //memset(newp, index & 0xFF, size);
 
 	    ///* Remember region */
-	    //trace->blocks[index] = newp;
-	    //trace->block_sizes[index] = size;
+	    //e->block = newp;
+	    //e->size = size;
 	    break;
 
         case FREE: /* mm_free */
 	    
-	    /* Remove region from list and call student's free function */
-	    p = trace->blocks[index];
-	    remove_range(ranges, p);
-	    mm_free(p);
+	    /* Remove region from bitmap and call student's free function */
+	    if ((e = freed_block(ids, index, tracenum, opnum+i)) == NULL)
+		return 0;
+	    if (verify && !check_fill(e, index, tracenum, opnum+i, "at free"))
+		return 0;
+	    p = e->block;
+	    if (!remove_range(shadow, p, e->size, tracenum, opnum+i))
+		return 0;
+	    idmap_remove(ids, index);
+	    a->free(p);
 	    break;
 
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
+      }
+    }
 
+    /* Blocks the trace leaves allocated must have been left alone too */
+    if (verify) {
+	for (index = idmap_next(ids, 0); index >= 0;
+	     index = idmap_next(ids, index + 1))
+	    if (!check_fill(idmap_get(ids, index), index, tracenum, opnum,
+			    "at the end of the trace"))
+		return 0;
     }
 
     /* As far as we know, this is a valid malloc package */
@@ -705,38 +1042,45 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   size of the heap in bytes after running the student's malloc 
  *   package on the trace. Note that our implementation of mem_sbrk() 
  *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
- *   
+ *   is always the high water mark of the heap. Engines without a
+ *   heap we can see get a utilization of 0.
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(allocator_t *a, trace_stream_t *stream,
+			   idmap_t *ids, int tracenum)
 {   
-    int i;
+    int i, n;
     int index;
-    int size; 
-    //int newsize, oldsize;
-    int max_total_size = 0;
-    int total_size = 0;
+    size_t size; 
+    //size_t newsize, oldsize;
+    size_t max_total_size = 0;
+    size_t total_size = 0;
     char *p;
     //char *newp, *oldp;
+    traceop_t *ops;
+    idmap_ent_t *e;
+    alloc_stats_t st;
+
+    if (!a->heap)
+	return 0;
 
-    /* initialize the heap and the mm malloc package */
-    mem_reset_brk();
-    if (mm_init() < 0)
-	app_error("mm_init failed in eval_mm_util");
+    /* initialize the heap and the malloc package */
+    if (start_engine(a, ids) < 0)
+	app_error("init failed in eval_mm_util");
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    trace_stream_rewind(stream);
+    while ((n = trace_stream_next(stream, &ops)) > 0) {
+      for (i = 0;  i < n;  i++) {
+        switch (ops[i].type) {
 
         case ALLOC: /* mm_alloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
+	    index = ops[i].index;
+	    size = ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
-		app_error("mm_malloc failed in eval_mm_util");
+	    if ((p = a->malloc(size)) == NULL) 
+		app_error("malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
-	    trace->blocks[index] = p;
-	    trace->block_sizes[index] = size;
+	    idmap_add(ids, index, p, size);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -749,17 +1093,18 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 
     /* BSK: not considering realloc */
 	//case REALLOC: /* mm_realloc */
-	//    index = trace->ops[i].index;
-	//    newsize = trace->ops[i].size;
-	//    oldsize = trace->block_sizes[index];
+	//    index = ops[i].index;
+	//    newsize = ops[i].size;
+	//    e = idmap_get(ids, index);
+	//    oldsize = e->size;
 
-	//    oldp = trace->blocks[index];
+	//    oldp = e->block;
 	//    if ((newp = mm_realloc(oldp,newsize)) == NULL)
 	//	app_error("mm_realloc failed in eval_mm_util");
 
 	//    /* Remember region and size */
-	//    trace->blocks[index] = newp;
-	//    trace->block_sizes[index] = newsize;
+	//    e->block = newp;
+	//    e->size = newsize;
 	//    
 	//    /* Keep track of current total size
 	//     * of all allocated blocks */
@@ -771,11 +1116,14 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	//    break;
 
         case FREE: /* mm_free */
-	    index = trace->ops[i].index;
-	    size = trace->block_sizes[index];
-	    p = trace->blocks[index];
+	    index = ops[i].index;
+	    if ((e = idmap_get(ids, index)) == NULL || e->block == NULL)
+		app_error("free of an unallocated block in eval_mm_util");
+	    size = e->size;
+	    p = e->block;
+	    idmap_remove(ids, index);
 	    
-	    mm_free(p);
+	    a->free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -787,178 +1135,951 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
+      }
+    }
+
+    a->stats(&st, 0);
+    return ((double)max_total_size / (double)st.heap_size);
+}
+
+/*
+ * frag_sample - Write one row of a fragmentation timeline: the op
+ *     number, the live payload bytes, what a walk of the heap finds,
+ *     and the external fragmentation index 1 - largest free block /
+ *     free bytes (0 when free memory is all in one block)
+ */
+static void frag_sample(allocator_t *a, FILE *fp, int opnum, size_t live)
+{
+    alloc_stats_t st;
+
+    a->stats(&st, 1);
+    fprintf(fp, "%d,%lu,%lu,%lu,%lu,%lu,%.4f,%.4f\n", opnum,
+	    (unsigned long)live, (unsigned long)st.heap_size,
+	    (unsigned long)st.free_bytes, (unsigned long)st.largest_free,
+	    (unsigned long)st.free_blocks,
+	    st.free_bytes ? 1 - (double)st.largest_free / st.free_bytes : 0.0,
+	    st.heap_size ? (double)live / st.heap_size : 0.0);
+}
+
+/*
+ * eval_mm_frag - Replay a trace an engine with a heap passed, writing
+ *     a fragmentation timeline to fp: a row every frag_interval ops,
+ *     and one after the last op
+ */
+static void eval_mm_frag(allocator_t *a, trace_stream_t *stream, 
+			 idmap_t *ids, FILE *fp)
+{
+    int i, n, opnum;
+    size_t live = 0;
+    traceop_t *ops;
+    idmap_ent_t *e;
+    char *p;
+
+    if (start_engine(a, ids) < 0)
+	app_error("init failed in eval_mm_frag");
+
+    fprintf(fp, "op,live_bytes,heap_bytes,free_bytes,largest_free,"
+	    "free_blocks,ext_frag,util\n");
+    trace_stream_rewind(stream);
+    for (opnum = 0; (n = trace_stream_next(stream, &ops)) > 0; opnum += n) {
+	for (i = 0; i < n; i++) {
+	    if ((opnum + i) % frag_interval == 0)
+		frag_sample(a, fp, opnum + i, live);
+	    switch (ops[i].type) {
+	    case ALLOC:
+		if ((p = a->malloc(ops[i].size)) == NULL)
+		    app_error("malloc failed in eval_mm_frag");
+		idmap_add(ids, ops[i].index, p, ops[i].size);
+		live += ops[i].size;
+		break;
+	    case FREE:
+		if ((e = idmap_get(ids, ops[i].index)) == NULL || 
+		    e->block == NULL)
+		    app_error("free of an unallocated block in eval_mm_frag");
+		live -= e->size;
+		a->free(e->block);
+		idmap_remove(ids, ops[i].index);
+		break;
+	    default:
+		app_error("Nonexistent request type in eval_mm_frag");
+	    }
+	}
+    }
+    frag_sample(a, fp, opnum, live);
+}
+
+/*
+ * resume_replay - Replay a trace for eval_mm_resume, moving the heap
+ *     to a new address halfway through: each live block is taken down
+ *     to its offset in the heap, which is detached, held out of the
+ *     way and attached again. The engine must take the heap up as it
+ *     was rather than lay a new one down, and every block must come
+ *     back intact at its offset in the new mapping.
+ */
+static int resume_replay(allocator_t *a, trace_stream_t *stream,
+			 idmap_t *ids, int tracenum, char *path)
+{
+    int i, n, opnum, index, half = trace_stream_hdr(stream)->num_ops / 2;
+    size_t *offs, heapsize;
+    char *p, *lo;
+    void *hole;
+    int hole_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    traceop_t *ops;
+    idmap_ent_t *e;
+
+#ifdef MAP_FIXED_NOREPLACE
+    hole_flags |= MAP_FIXED_NOREPLACE;
+#endif
+
+    if ((offs = (size_t *)calloc(trace_stream_hdr(stream)->num_ids + 1, 
+				 sizeof(size_t))) == NULL)
+	unix_error("offs calloc in resume_replay failed");
+    trace_stream_rewind(stream);
+    for (opnum = 0; (n = trace_stream_next(stream, &ops)) > 0; opnum += n) {
+      for (i = 0; i < n; i++) {
+	if (opnum + i == half) {
+	    for (index = idmap_next(ids, 0); index >= 0;
+		 index = idmap_next(ids, index + 1))
+		offs[index] = mem_heap_off(idmap_get(ids, index)->block);
+	    lo = mem_heap_lo();
+	    heapsize = mem_heapsize();
+	    mem_deinit();
+
+	    /* Keep the old address taken, so the heap has to move */
+	    hole = mmap(lo - mem_pagesize(), mem_pagesize(), PROT_NONE,
+			hole_flags, -1, 0);
+	    if (mem_attach(path, NULL) < 0)
+		app_error("Could not attach the heap file again");
+	    if (hole != MAP_FAILED)
+		munmap(hole, mem_pagesize());
+	    if (mem_heap_lo() == lo) {
+		malloc_error(tracenum, opnum + i, "The heap was attached again "
+			     "at its old address, so it did not move.");
+		free(offs);
+		return 0;
+	    }
+	    if (a->init() < 0 || mem_heapsize() != heapsize) {
+		sprintf(msg, "%s_init %s the attached heap.", a->name,
+			mem_heapsize() != heapsize ? "did not resume" : "failed on");
+		malloc_error(tracenum, opnum + i, msg);
+		free(offs);
+		return 0;
+	    }
+	    for (index = idmap_next(ids, 0); index >= 0;
+		 index = idmap_next(ids, index + 1)) {
+		e = idmap_get(ids, index);
+		e->block = mem_heap_ptr(offs[index]);
+		if (!check_fill(e, index, tracenum, opnum + i,
+				"after the heap was attached again")) {
+		    free(offs);
+		    return 0;
+		}
+	    }
+	}
+
+	index = ops[i].index;
+	switch (ops[i].type) {
+	case ALLOC:
+	    if ((p = a->malloc(ops[i].size)) == NULL) {
+		sprintf(msg, "%s_malloc failed.", a->name);
+		malloc_error(tracenum, opnum + i, msg);
+		free(offs);
+		return 0;
+	    }
+	    memset(p, index & 0xFF, ops[i].size);
+	    idmap_add(ids, index, p, ops[i].size);
+	    break;
+	case FREE:
+	    if ((e = freed_block(ids, index, tracenum, opnum + i)) == NULL ||
+		!check_fill(e, index, tracenum, opnum + i, "at free")) {
+		free(offs);
+		return 0;
+	    }
+	    a->free(e->block);
+	    idmap_remove(ids, index);
+	    break;
+	default:
+	    app_error("Nonexistent request type in resume_replay");
+	}
+      }
     }
+    free(offs);
+    return 1;
+}
 
-    return ((double)max_total_size / (double)mem_heapsize());
+/*
+ * eval_mm_resume - Check that an engine with a heap picks up where it
+ *     left off on a heap kept in a file: the trace is replayed on a
+ *     heap in path that is detached and attached again halfway through
+ *     (see resume_replay). The default heap is put back afterwards.
+ */
+static int eval_mm_resume(allocator_t *a, trace_stream_t *stream,
+			  idmap_t *ids, int tracenum, char *path)
+{
+    int ok = 0;
+
+    stop_engine(a, ids);
+    mem_deinit();
+    if (mem_init_file(path, NULL) < 0)
+	app_error("Could not create the heap file");
+    if (a->init() < 0) {
+	sprintf(msg, "%s_init failed on the heap file.", a->name);
+	malloc_error(tracenum, 0, msg);
+    }
+    else
+	ok = resume_replay(a, stream, ids, tracenum, path);
+    idmap_clear(ids);
+    mem_deinit();
+    mem_init();
+    return ok;
 }
 
 
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
- *    to measure the running time of the mm malloc package.
+ *    to measure the running time of an engine, such as the mm malloc
+ *    package or libc malloc.
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size;
-    //int newsize;
-    char *p, *block;
+    int i, n, index;
+    size_t size;
+    //size_t newsize;
+    char *p;
     //char *newp, *oldp;
-    trace_t *trace = ((speed_t *)ptr)->trace;
+    traceop_t *ops;
+    idmap_ent_t *e;
+    speed_t *params = (speed_t *)ptr;
+    allocator_t *a = params->alloc;
+    trace_stream_t *stream = params->stream;
+    idmap_t *ids = params->ids;
+    double stall = trace_stream_stall(stream);
+    double start;
+
+    /* Free what the last run left live, if the engine can't reset,
+       where time_speed will take it out of this run's time */
+    if (a->reset == NULL) {
+	start = now_secs();
+	free_live(a, ids);
+	params->stall += now_secs() - start;
+    }
 
-    /* Reset the heap and initialize the mm package */
-    mem_reset_brk();
-    if (mm_init() < 0) 
-	app_error("mm_init failed in eval_mm_speed");
+    /* Reset the heap and initialize the malloc package */
+    if (start_engine(a, ids) < 0) 
+	app_error("init failed in eval_mm_speed");
 
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
-        switch (trace->ops[i].type) {
+    trace_stream_rewind(stream);
+    while ((n = trace_stream_next(stream, &ops)) > 0)
+      for (i = 0;  i < n;  i++)
+        switch (ops[i].type) {
 
         case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
-		app_error("mm_malloc error in eval_mm_speed");
-            trace->blocks[index] = p;
+            index = ops[i].index;
+            size = ops[i].size;
+            if ((p = a->malloc(size)) == NULL)
+		app_error("malloc error in eval_mm_speed");
+            idmap_add(ids, index, p, size);
             break;
 
     /* BSK: not considering realloc*/
 	//case REALLOC: /* mm_realloc */
-	//    index = trace->ops[i].index;
-    //        newsize = trace->ops[i].size;
-	//    oldp = trace->blocks[index];
+	//    index = ops[i].index;
+    //        newsize = ops[i].size;
+	//    e = idmap_get(ids, index);
+	//    oldp = e->block;
     //        if ((newp = mm_realloc(oldp,newsize)) == NULL)
 	//	app_error("mm_realloc error in eval_mm_speed");
-    //        trace->blocks[index] = newp;
+    //        e->block = newp;
     //        break;
 
         case FREE: /* mm_free */
-            index = trace->ops[i].index;
-            block = trace->blocks[index];
-            mm_free(block);
+            index = ops[i].index;
+	    if ((e = idmap_get(ids, index)) == NULL || e->block == NULL)
+		app_error("free of an unallocated block in eval_mm_speed");
+            a->free(e->block);
+            idmap_remove(ids, index);
             break;
 
 	default:
-	    app_error("Nonexistent request type in eval_mm_valid");
+	    app_error("Nonexistent request type in eval_mm_speed");
         }
+
+    /* Let time_speed take out the time spent waiting on the decoder */
+    params->stall += trace_stream_stall(stream) - stall;
+    params->runs++;
 }
 
 /*
- * eval_libc_valid - We run this function to make sure that the
- *    libc malloc can run to completion on the set of traces.
- *    We'll be conservative and terminate if any libc malloc call fails.
- *
+ * eval_mm_latency - Replay a trace an engine passed, timing each
+ *    request on its own with the cycle counter. The timer overhead is
+ *    taken off each sample, which is then added to the histogram of
+ *    all requests, of its type, and of its size class.
  */
-static int eval_libc_valid(trace_t *trace, int tracenum)
+static void eval_mm_latency(allocator_t *a, trace_stream_t *stream, 
+			    idmap_t *ids, lat_hist_t *hists)
 {
-    int i;
-    //int newsize;
+    int i, n, index, row;
+    size_t size;
     char *p;
-    //char *newp, *oldp;
+    uint64_t t0, t1, dt;
+    traceop_t *ops;
+    idmap_ent_t *e;
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    for (i = 0; i < LAT_ROWS; i++)
+	lat_clear(&hists[i]);
 
-        case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
-		malloc_error(tracenum, i, "libc malloc failed");
-		unix_error("System message");
-	    }
-	    trace->blocks[trace->ops[i].index] = p;
+    /* Reset the heap and initialize the malloc package */
+    if (start_engine(a, ids) < 0) 
+	app_error("init failed in eval_mm_latency");
+
+    trace_stream_rewind(stream);
+    while ((n = trace_stream_next(stream, &ops)) > 0) {
+      for (i = 0;  i < n;  i++) {
+	index = ops[i].index;
+        switch (ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+	    size = ops[i].size;
+	    t0 = cycle_stamp();
+	    p = a->malloc(size);
+	    t1 = cycle_stamp();
+	    if (p == NULL)
+		app_error("malloc error in eval_mm_latency");
+	    idmap_add(ids, index, p, size);
+	    row = LAT_MALLOC;
 	    break;
 
-    /* BSK: not considering realloc */
-	//case REALLOC: /* realloc */
-    //        newsize = trace->ops[i].size;
-	//    oldp = trace->blocks[trace->ops[i].index];
-	//    if ((newp = realloc(oldp, newsize)) == NULL) {
-	//	malloc_error(tracenum, i, "libc realloc failed");
-	//	unix_error("System message");
-	//    }
-	//    trace->blocks[trace->ops[i].index] = newp;
-	//    break;
-	    
-        case FREE: /* free */
-	    free(trace->blocks[trace->ops[i].index]);
+        case FREE: /* mm_free */
+	    if ((e = idmap_get(ids, index)) == NULL || e->block == NULL)
+		app_error("free of an unallocated block in eval_mm_latency");
+	    p = e->block;
+	    size = e->size;
+	    idmap_remove(ids, index);
+	    t0 = cycle_stamp();
+	    a->free(p);
+	    t1 = cycle_stamp();
+	    row = LAT_FREE;
 	    break;
 
 	default:
-	    app_error("invalid operation type  in eval_libc_valid");
-	}
+	    app_error("Nonexistent request type in eval_mm_latency");
+	    return;
+        }
+
+	dt = t1 - t0 > lat_ovhd ? t1 - t0 - lat_ovhd : 0;
+	lat_add(&hists[LAT_ALL], dt);
+	lat_add(&hists[row], dt);
+	lat_add(&hists[LAT_CLASS(lat_size_class(size))], dt);
+      }
     }
+}
 
-    return 1;
+/*
+ * time_speed - Time one of the xxx_speed functions with fsecs, less
+ *    the average time a run spent waiting for windows to be decoded
+ *    or freeing the blocks the run before it left live.
+ *    With -R, time it with fsecs_dist instead and fill in *dist.
+ */
+static double time_speed(fsecs_test_funct f, speed_t *params,
+			 fsecs_dist_t *dist)
+{
+    double secs, stall;
+
+    params->stall = 0;
+    params->runs = 0;
+    if (robust && dist != NULL) {
+	secs = fsecs_dist(f, params, dist);
+	stall = params->stall / params->runs;
+	dist->median -= stall;
+	dist->ci_lo -= stall;
+	dist->ci_hi -= stall;
+    }
+    else {
+	secs = fsecs(f, params);
+	stall = params->stall / params->runs;
+    }
+    return secs - stall;
 }
 
-/* 
- * eval_libc_speed - This is the function that is used by fcyc() to
- *    measure the running time of the libc malloc package on the set
- *    of traces.
+/*****************************************************************
+ * The following routines evaluate one trace at a time, and run the
+ * evaluation over every trace, either here, one pass over all of the
+ * traces at a time, or spread over -j worker processes
+ ****************************************************************/
+
+/*
+ * time_latency - Measure per-request latency on a trace an engine
+ *     passed and keep the percentiles
  */
-static void eval_libc_speed(void *ptr)
+static void time_latency(allocator_t *a, trace_stream_t *trace, idmap_t *ids,
+			 stats_t *stats)
 {
-    int i;
-    int index, size;
-    //int newsize;
-    char *p, *block;
-    //char *newp, *oldp, 
-    trace_t *trace = ((speed_t *)ptr)->trace;
-
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
-        case ALLOC: /* malloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
-	    if ((p = malloc(size)) == NULL)
-		unix_error("malloc failed in eval_libc_speed");
-	    trace->blocks[index] = p;
-	    break;
+    lat_hist_t *hists;
+    int r;
+
+    if ((hists = (lat_hist_t *)malloc(LAT_ROWS * sizeof(lat_hist_t))) == NULL)
+	unix_error("malloc failed in time_latency");
+    eval_mm_latency(a, trace, ids, hists);
+    for (r = 0; r < LAT_ROWS; r++)
+	lat_summarize(&hists[r], &stats->lat[r]);
+    free(hists);
+}
 
-    /* BSK: not considering realloc */
-	//case REALLOC: /* realloc */
-	//    index = trace->ops[i].index;
-	//    newsize = trace->ops[i].size;
-	//    oldp = trace->blocks[index];
-	//    if ((newp = realloc(oldp, newsize)) == NULL)
-	//	unix_error("realloc failed in eval_libc_speed\n");
-	//    
-	//    trace->blocks[index] = newp;
-	//    break;
-	    
-        case FREE: /* free */
-	    index = trace->ops[i].index;
-	    block = trace->blocks[index];
-	    free(block);
-	    break;
-	    default:
-	        app_error("Nonexistent request type in eval_libc_speed");
-	}
-    }
+/*
+ * time_counters - Count CPU events over one run of an engine on a
+ *     trace it passed, after a warmup run. Only this thread is counted,
+ *     so with -S the decoder's work is left out.
+ */
+static void time_counters(allocator_t *a, trace_stream_t *trace, idmap_t *ids,
+			  stats_t *stats)
+{
+    speed_t speed_params;
+    pc_group_t g;
+
+    speed_params.alloc = a;
+    speed_params.stream = trace;
+    speed_params.ids = ids;
+    speed_params.stall = 0;
+    speed_params.runs = 0;
+    eval_mm_speed(&speed_params);
+
+    stats->pc.mask = 0;
+    if (pc_open(&g) == 0)
+	return;
+    pc_start(&g);
+    eval_mm_speed(&speed_params);
+    pc_stop(&g, stats->ops, &stats->pc);
+    pc_close(&g);
 }
 
-/*************************************
- * Some miscellaneous helper routines
- ************************************/
+/*
+ * write_frag - Write the fragmentation timeline of a trace an engine
+ *     with a heap passed to <trace>.frag.csv in the current directory
+ */
+static void write_frag(allocator_t *a, trace_stream_t *trace, idmap_t *ids,
+		       char *tracefile)
+{
+    char path[MAXLINE/2], *base;
+    FILE *fp;
 
+    base = strrchr(tracefile, '/') ? strrchr(tracefile, '/') + 1 : tracefile;
+    snprintf(path, sizeof(path), "%s.frag.csv", base);
+    if ((fp = fopen(path, "w")) == NULL) {
+	sprintf(msg, "Could not open %s for writing", path);
+	unix_error(msg);
+    }
+    eval_mm_frag(a, trace, ids, fp);
+    stop_engine(a, ids);
+    if (fclose(fp) != 0) {
+	sprintf(msg, "Could not write %s", path);
+	unix_error(msg);
+    }
+    if (verbose > 1)
+	printf("Wrote fragmentation timeline to %s\n", path);
+}
 
 /*
- * printresults - prints a performance summary for some malloc package
+ * check_mm - Check an engine for correctness on one trace and, if it
+ *     passes, measure its utilization and time it. The -L and -P
+ *     measurements are made for the first engine only.
  */
-static void printresults(int n, stats_t *stats) 
+static void check_mm(allocator_t *a, trace_stream_t *trace, idmap_t *ids,
+		     int tracenum, shadow_t *shadow, stats_t *stats)
 {
-    int i;
-    double secs = 0;
-    double ops = 0;
-    double util = 0;
+    speed_t speed_params;
+    alloc_stats_t st;
 
-    /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s%s\n", 
-	   "id", "valid", "util", "ops", " secs", "  Kops", "   Trace");
-    for (i=0; i < n; i++) {
-	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f %10.6f %6.0f %s\n", 
-		   i,
-		   "yes",
+    stats->ops = trace_stream_hdr(trace)->num_ops;
+    if (verbose > 1)
+	printf("Checking %s for correctness, ", a->desc);
+    stats->valid = eval_mm_valid(a, trace, ids, tracenum, shadow);
+    if (stats->valid) {
+	if (verbose > 1)
+	    printf("efficiency, ");
+	stats->util = eval_mm_util(a, trace, ids, tracenum);
+	a->stats(&st, 0);
+	stats->search = st.search;
+	speed_params.alloc = a;
+	speed_params.stream = trace;
+	speed_params.ids = ids;
+	if (verbose > 1)
+	    printf("and performance.\n");
+#ifdef MM_PROFILE
+	mm_profile_reset();
+#endif
+	stats->secs = time_speed(eval_mm_speed, &speed_params, &stats->dist);
+#ifdef MM_PROFILE
+	mm_profile_dump(&stats->prof);
+#endif
+	if (latency && a == engines[0])
+	    time_latency(a, trace, ids, stats);
+	if (counters && a == engines[0])
+	    time_counters(a, trace, ids, stats);
+    }
+    stop_engine(a, ids);
+}
+
+/*
+ * time_thp - Time an engine on a trace it passed, on the current
+ *     (huge page) heap. The base-page time was taken on a heap the
+ *     correctness and utilization passes had already committed, so
+ *     this heap is committed by an untimed run first: the comparison
+ *     is of TLB behavior, not of the cost of faulting pages in.
+ */
+static void time_thp(allocator_t *a, trace_stream_t *trace, idmap_t *ids,
+		     stats_t *stats)
+{
+    speed_t speed_params;
+
+    if (!stats->valid)
+	return;
+    speed_params.alloc = a;
+    speed_params.stream = trace;
+    speed_params.ids = ids;
+    speed_params.stall = 0;
+    speed_params.runs = 0;
+    eval_mm_speed(&speed_params);
+    stats->thp_secs = time_speed(eval_mm_speed, &speed_params, NULL);
+    stop_engine(a, ids);
+}
+
+/*
+ * run_passes - Evaluate every trace in this process: each engine in
+ *     turn, then the first engine on huge pages if -H was given and
+ *     it has a heap
+ */
+static void run_passes(char **tracefiles, int n, stats_t **stats)
+{
+    int i, e;
+    trace_stream_t **traces;   /* every trace file, opened once */
+    idmap_t *ids;              /* blocks of the trace being evaluated */
+    int max_ids = 0;           /* most ids in any one trace */
+    shadow_t shadow = {NULL};  /* keeps track of block extents for one trace */
+
+    /* 
+     * Open each trace once; all evaluation passes share it. Unless -S
+     * was given, every trace fits in a single window and is decoded
+     * into memory right here.
+     */
+    if ((traces = (trace_stream_t **)calloc(n, sizeof(trace_stream_t *))) == NULL)
+	unix_error("traces calloc in run_passes failed");
+    for (i=0; i < n; i++) {
+	traces[i] = trace_stream_open(tracedir, tracefiles[i], window);
+	if (trace_stream_hdr(traces[i])->num_ids > max_ids)
+	    max_ids = trace_stream_hdr(traces[i])->num_ids;
+    }
+    ids = idmap_create(max_ids);
+
+    /* Initialize the simulated memory system in memlib.c */
+    if (thp_compare)
+	mem_set_thp(MEM_THP_OFF); /* baseline run uses base pages only */
+    mem_init(); 
+
+    /*
+     * Run and evaluate each engine
+     */
+    for (e = 0; e < num_engines; e++) {
+	if (verbose > 1)
+	    printf("\nTesting %s\n", engines[e]->desc);
+	for (i=0; i < n; i++) {
+	    mem_trim(); /* give back what the last trace committed */
+	    check_mm(engines[e], traces[i], ids, i, &shadow, &stats[e][i]);
+	    if (e == 0 && frag_interval && stats[e][i].valid &&
+		engines[e]->heap)
+		write_frag(engines[e], traces[i], ids, tracefiles[i]);
+	}
+    }
+
+    /* Optionally check the first engine resumes a heap kept in a file */
+    if (heap_file && engines[0]->heap) {
+	if (verbose > 1)
+	    printf("\nResuming %s on a heap in %s\n", engines[0]->desc,
+		   heap_file);
+	for (i=0; i < n; i++)
+	    if (stats[0][i].valid)
+		stats[0][i].resumed = eval_mm_resume(engines[0], traces[i], 
+						     ids, i, heap_file);
+    }
+
+    /* 
+     * Optionally time the valid traces again on a heap backed by
+     * transparent huge pages 
+     */
+    if (thp_compare && engines[0]->heap) {
+	if (verbose > 1)
+	    printf("\nTesting %s with huge pages\n", engines[0]->desc);
+	mem_deinit();
+	mem_set_thp(MEM_THP_ON);
+	mem_init();
+	if (!mem_thp_enabled())
+	    printf("Warning: huge pages were not granted for the heap\n");
+	for (i=0; i < n; i++)
+	    time_thp(engines[0], traces[i], ids, &stats[0][i]);
+    }
+
+    for (i=0; i < n; i++)
+	trace_stream_close(traces[i]);
+    free(traces);
+    idmap_destroy(ids);
+}
+
+/*
+ * read_full, write_full - Move exactly len bytes through a pipe;
+ *     read_full returns 0 if the writer has gone away
+ */
+static int read_full(int fd, void *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+	if ((n = read(fd, buf, len)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    unix_error("read error on a worker pipe");
+	}
+	if (n == 0)
+	    return 0;
+	buf = (char *)buf + n;
+	len -= n;
+    }
+    return 1;
+}
+
+static void write_full(int fd, void *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+	if ((n = write(fd, buf, len)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    unix_error("write error on a worker pipe");
+	}
+	buf = (char *)buf + n;
+	len -= n;
+    }
+}
+
+/*
+ * pin_cpu - Bind the calling process to the k-th CPU it is allowed to
+ *     run on, wrapping around if there are fewer than k+1
+ */
+static void pin_cpu(int k)
+{
+    cpu_set_t allowed, one;
+    int cpu;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+	return;
+    k %= CPU_COUNT(&allowed);
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+	if (CPU_ISSET(cpu, &allowed) && k-- == 0) {
+	    CPU_ZERO(&one);
+	    CPU_SET(cpu, &one);
+	    if (sched_setaffinity(0, sizeof(one), &one) < 0 && verbose > 1)
+		printf("Warning: could not pin worker to CPU %d\n", cpu);
+	    return;
+	}
+    }
+}
+
+/*
+ * worker - Body of a -j worker process, pinned to its own CPU with a
+ *     heap of its own: evaluate each trace number read from cmd and
+ *     send the results back on res, until cmd is closed
+ */
+static void worker(int cpu, int cmd, int res, char **tracefiles)
+{
+    int i, e;
+    job_result_t r;
+    trace_stream_t *trace;
+    idmap_t *ids;
+    shadow_t shadow = {NULL};
+
+    pin_cpu(cpu);
+    if (thp_compare)
+	mem_set_thp(MEM_THP_OFF);
+    mem_init();
+
+    while (read_full(cmd, &i, sizeof(int))) {
+	memset(&r, 0, sizeof(r));
+	r.tracenum = i;
+	trace = trace_stream_open(tracedir, tracefiles[i], window);
+	ids = idmap_create(trace_stream_hdr(trace)->num_ids);
+	mem_trim(); /* give back what the last trace committed */
+
+	for (e = 0; e < num_engines; e++)
+	    check_mm(engines[e], trace, ids, i, &shadow, &r.stats[e]);
+	if (frag_interval && r.stats[0].valid && engines[0]->heap)
+	    write_frag(engines[0], trace, ids, tracefiles[i]);
+	if (thp_compare && r.stats[0].valid && engines[0]->heap) {
+	    mem_deinit();
+	    mem_set_thp(MEM_THP_ON);
+	    mem_init();
+	    if (!mem_thp_enabled())
+		printf("Warning: huge pages were not granted for the heap\n");
+	    time_thp(engines[0], trace, ids, &r.stats[0]);
+	    mem_deinit();
+	    mem_set_thp(MEM_THP_OFF);
+	    mem_init();
+	}
+
+	idmap_destroy(ids);
+	trace_stream_close(trace);
+	r.errors = errors;
+	errors = 0;
+	fflush(stdout);
+	write_full(res, &r, sizeof(r));
+    }
+    exit(0);
+}
+
+/*
+ * run_workers - Evaluate every trace in up to jobs worker processes.
+ *     Each worker is handed one trace number at a time over its own
+ *     command pipe and gets the next when it reports back, so long
+ *     traces don't hold up a fixed share of short ones. The results
+ *     land in the stats arrays by trace number, so they print in
+ *     the same order as without -j.
+ */
+static void run_workers(char **tracefiles, int n, int jobs, stats_t **stats)
+{
+    int w, k, e, next = 0, done = 0;
+    int to_worker[2], from_worker[2];
+    int *cmd, *res;
+    pid_t *pids;
+    struct pollfd *pfd;
+    job_result_t r;
+
+    if (jobs > n)
+	jobs = n;
+    cmd = (int *)malloc(jobs * sizeof(int));
+    res = (int *)malloc(jobs * sizeof(int));
+    pids = (pid_t *)malloc(jobs * sizeof(pid_t));
+    pfd = (struct pollfd *)malloc(jobs * sizeof(struct pollfd));
+    if (!cmd || !res || !pids || !pfd)
+	unix_error("malloc failed in run_workers");
+
+    /* 
+     * Start the workers; anything still buffered must not be copied.
+     * A worker that dies shows up as a write error rather than killing
+     * the driver with SIGPIPE.
+     */
+    fflush(stdout);
+    signal(SIGPIPE, SIG_IGN);
+    for (w = 0; w < jobs; w++) {
+	if (pipe(to_worker) < 0 || pipe(from_worker) < 0)
+	    unix_error("pipe error in run_workers");
+	if ((pids[w] = fork()) < 0)
+	    unix_error("fork error in run_workers");
+	if (pids[w] == 0) {
+	    /* Keep only this worker's ends of its own two pipes */
+	    close(to_worker[1]);
+	    close(from_worker[0]);
+	    for (k = 0; k < w; k++) {
+		close(cmd[k]);
+		close(res[k]);
+	    }
+	    worker(w, to_worker[0], from_worker[1], tracefiles);
+	}
+	close(to_worker[0]);
+	close(from_worker[1]);
+	cmd[w] = to_worker[1];
+	res[w] = from_worker[0];
+    }
+
+    /* Hand each worker its first trace */
+    for (w = 0; w < jobs; w++) {
+	write_full(cmd[w], &next, sizeof(int));
+	next++;
+	pfd[w].fd = res[w];
+	pfd[w].events = POLLIN;
+    }
+
+    /* Collect results, handing out the remaining traces as workers free up */
+    while (done < n) {
+	if (poll(pfd, jobs, -1) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    unix_error("poll error in run_workers");
+	}
+	for (w = 0; w < jobs; w++) {
+	    if (pfd[w].fd < 0 || pfd[w].revents == 0)
+		continue;
+	    if (!read_full(res[w], &r, sizeof(r))) {
+		sprintf(msg, "ERROR: worker %d exited before finishing its trace", w);
+		app_error(msg);
+	    }
+	    for (e = 0; e < num_engines; e++)
+		stats[e][r.tracenum] = r.stats[e];
+	    errors += r.errors;
+	    done++;
+	    if (next < n) {
+		write_full(cmd[w], &next, sizeof(int));
+		next++;
+	    }
+	    else {
+		close(cmd[w]);   /* the worker exits when it sees EOF */
+		close(res[w]);
+		pfd[w].fd = -1;
+	    }
+	}
+    }
+
+    for (w = 0; w < jobs; w++)
+	waitpid(pids[w], NULL, 0);
+    free(cmd);
+    free(res);
+    free(pids);
+    free(pfd);
+}
+
+/*************************************
+ * Some miscellaneous helper routines
+ ************************************/
+
+
+/*****************************************************************
+ * The following routines replay multi-threaded traces with -T, one
+ * pthread per trace thread
+ ****************************************************************/
+
+/*
+ * locked_xxx - mt_engine behind one lock, so that threads can share it
+ *     even if it is not thread-safe
+ */
+static void locked_reset(void)
+{
+    mt_engine->reset();
+    if (mt_engine->init() < 0)
+	app_error("init failed in locked_reset");
+}
+
+static void *locked_malloc(size_t size)
+{
+    void *p;
+
+    pthread_mutex_lock(&mt_lock);
+    p = mt_engine->malloc(size);
+    pthread_mutex_unlock(&mt_lock);
+    return p;
+}
+
+static void locked_free(void *ptr)
+{
+    pthread_mutex_lock(&mt_lock);
+    mt_engine->free(ptr);
+    pthread_mutex_unlock(&mt_lock);
+}
+
+/*
+ * print_mt - Print one row of the -T table: the fastest of MT_RUNS
+ *     replays of a trace on a given number of threads
+ */
+static void print_mt(mt_trace_t *t, int threads, mt_alloc_t *a, 
+		     double *base, char *name)
+{
+    mt_result_t r, best;
+    double kops, min = DBL_MAX, max = 0, sum = 0;
+    int run, k, busy = 0;
+
+    for (run = 0; run < MT_RUNS; run++) {
+	mt_replay(t, threads, a, &r);
+	if (run == 0 || r.secs < best.secs)
+	    best = r;
+    }
+    for (k = 0; k < best.workers; k++) {
+	if (best.ops[k] == 0 || best.worker_secs[k] <= 0)
+	    continue;
+	kops = (best.ops[k]/1e3) / best.worker_secs[k];
+	min = kops < min ? kops : min;
+	max = kops > max ? kops : max;
+	sum += kops;
+	busy++;
+    }
+    kops = (t->num_ops/1e3) / best.secs;
+    if (threads == 1)
+	*base = kops;
+    printf("%8d%10.0f%8.2fx%10.0f%10.0f%10.0f   %s\n", threads, kops,
+	   kops / *base, busy ? min : 0, busy ? sum / busy : 0, max, name);
+}
+
+/*
+ * run_threads - Replay each trace the first engine passed on 1, 2, ...
+ *     mt_threads threads, and print aggregate and per-thread
+ *     throughput for every engine that passed it, calling those that
+ *     are not thread-safe behind a lock
+ */
+static void run_threads(char **tracefiles, int n, stats_t **stats)
+{
+    mt_alloc_t mt_alloc;
+    allocator_t *a;
+    char path[MAXLINE];
+    mt_trace_t **traces;
+    double base;
+    int i, k, e;
+
+    if ((traces = (mt_trace_t **)calloc(n, sizeof(mt_trace_t *))) == NULL)
+	unix_error("calloc failed in run_threads");
+    for (i = 0; i < n; i++) {
+	if (!stats[0][i].valid)
+	    continue;
+	snprintf(path, sizeof(path), "%s%s", tracedir, tracefiles[i]);
+	traces[i] = mt_load(path);
+    }
+    if (mem_default_ctx() == NULL)
+	mem_init();
+
+    printf("Multi-threaded replay (best of %d), Kops overall and per thread:\n",
+	   MT_RUNS);
+    printf("%5s%8s%10s%9s%10s%10s%10s   %s\n", "id", "threads", "Kops",
+	   "speedup", "min", "avg", "max", "Trace");
+    for (i = 0; i < n; i++) {
+	if (traces[i] == NULL)
+	    continue;
+	mem_trim();
+	for (e = 0; e < num_engines; e++) {
+	    if (!stats[e][i].valid)
+		continue;
+	    a = mt_engine = engines[e];
+	    mt_alloc.reset = a->reset ? locked_reset : NULL;
+	    mt_alloc.malloc = a->thread_safe ? a->malloc : locked_malloc;
+	    mt_alloc.free = a->thread_safe ? a->free : locked_free;
+	    mt_alloc.realloc = a->thread_safe ? a->realloc : NULL;
+	    printf("%2d  %s%s", i, a->desc, a->thread_safe ? "" : " (one lock)");
+	    if (e == 0)
+		printf(", %d thread%s in the trace", traces[i]->num_threads,
+		       traces[i]->num_threads > 1 ? "s" : "");
+	    printf("\n");
+	    for (k = 1; k <= mt_threads; k++)
+		print_mt(traces[i], k, &mt_alloc, &base, 
+			 foption ? "" : default_tracefiles[i]);
+	}
+	mt_free(traces[i]);
+    }
+    printf("\n");
+    free(traces);
+}
+
+/*
+ * printresults - prints a performance summary for some malloc package
+ */
+static void printresults(int n, stats_t *stats) 
+{
+    int i;
+    double secs = 0;
+    double ops = 0;
+    double util = 0;
+
+    /* Print the individual results for each trace */
+    printf("%5s%7s %5s%8s%10s%6s%s\n", 
+	   "id", "valid", "util", "ops", " secs", "  Kops", "   Trace");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%10s%5.0f%%%8.0f %10.6f %6.0f %s\n", 
+		   i,
+		   "yes",
 		   stats[i].util*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
@@ -1002,6 +2123,938 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printcompare - prints the utilization and throughput of every engine
+ *    side by side, with each engine's throughput relative to the first
+ */
+static void printcompare(int n, stats_t **stats)
+{
+    int i, e;
+    double kops, kops0 = 0;
+    double secs[ALLOC_MAX] = {0}, ops[ALLOC_MAX] = {0}, util[ALLOC_MAX] = {0};
+    stats_t *s;
+
+    printf("%5s", "");
+    for (e = 0; e < num_engines; e++)
+	printf(e ? "%25s" : "%17s", engines[e]->name);
+    printf("\n%5s", "id");
+    for (e = 0; e < num_engines; e++)
+	printf(e ? "%7s%10s%8s" : "%7s%10s", "util", "Kops", "rel");
+    printf("   %s\n", "Trace");
+
+    for (i = 0; i < n; i++) {
+	printf("%2d%3s", i, "");
+	for (e = 0; e < num_engines; e++) {
+	    s = &stats[e][i];
+	    if (!s->valid) {
+		printf(e ? "%7s%10s%8s" : "%7s%10s", "-", "-", "-");
+		continue;
+	    }
+	    kops = (s->ops/1e3)/s->secs;
+	    if (engines[e]->heap)
+		printf("%6.0f%%", s->util*100.0);
+	    else
+		printf("%7s", "-");
+	    printf("%10.0f", kops);
+	    if (e == 0)
+		kops0 = kops;
+	    else if (stats[0][i].valid)
+		printf("%7.2fx", kops/kops0);
+	    else
+		printf("%8s", "-");
+	    secs[e] += s->secs;
+	    ops[e] += s->ops;
+	    util[e] += s->util;
+	}
+	printf("   %s\n", foption ? "" : default_tracefiles[i]);
+    }
+
+    printf("%-5s", "Total");
+    for (e = 0; e < num_engines; e++) {
+	if (engines[e]->heap)
+	    printf("%6.0f%%", (util[e]/n)*100.0);
+	else
+	    printf("%7s", "-");
+	printf("%10.0f", secs[e] > 0 ? (ops[e]/1e3)/secs[e] : 0);
+	if (e > 0)
+	    printf("%7.2fx", secs[e] > 0 && secs[0] > 0 ? 
+		   (ops[e]/secs[e]) / (ops[0]/secs[0]) : 0);
+    }
+    printf("\n");
+}
+
+/*
+ * printthp - prints mm throughput on base pages next to the throughput
+ *    on a huge page heap, as measured with -H
+ */
+static void printthp(int n, stats_t *stats)
+{
+    int i;
+    double secs = 0, thp_secs = 0, ops = 0;
+
+    printf("%5s%7s%10s%10s%9s   %s\n",
+	   "id", "valid", "4K Kops", "2M Kops", "speedup", "Trace");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%10s%10.0f%10.0f%8.2fx   %s\n",
+		   i,
+		   "yes",
+		   (stats[i].ops/1e3)/stats[i].secs,
+		   (stats[i].ops/1e3)/stats[i].thp_secs,
+		   stats[i].secs/stats[i].thp_secs,
+		   foption ? "" : default_tracefiles[i]);
+	    secs += stats[i].secs;
+	    thp_secs += stats[i].thp_secs;
+	    ops += stats[i].ops;
+	}
+	else {
+	    printf("%2d%10s%10s%10s%9s   %s\n",
+		   i, "no", "-", "-", "-",
+		   foption ? "" : default_tracefiles[i]);
+	}
+    }
+    if (errors == 0)
+	printf("%12s%10.0f%10.0f%8.2fx\n",
+	       "Total       ",
+	       (ops/1e3)/secs,
+	       (ops/1e3)/thp_secs,
+	       secs/thp_secs);
+}
+
+/*
+ * printlatency - prints the per-request latency percentiles measured
+ *    with -L next to each trace's throughput, followed by a row for
+ *    each request type and size class that occurred in the trace
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    int i, r;
+    lat_summary_t *s;
+
+    printf("%5s%7s%9s%9s%9s%9s%9s%10s   %s\n",
+	   "id", "valid", "Kops", "p50", "p90", "p99", "p99.9", "max", "Trace");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%10s%9s%9s%9s%9s%9s%10s   %s\n",
+		   i, "no", "-", "-", "-", "-", "-", "-",
+		   foption ? "" : default_tracefiles[i]);
+	    continue;
+	}
+	for (r = 0; r < LAT_ROWS; r++) {
+	    s = &stats[i].lat[r];
+	    if (r > LAT_ALL && s->n == 0)
+		continue;
+	    if (r == LAT_ALL)
+		printf("%2d%10s%9.0f", i, "yes", (stats[i].ops/1e3)/stats[i].secs);
+	    else
+		printf("%12s%9s", 
+		       r == LAT_MALLOC ? "malloc" : r == LAT_FREE ? "free" :
+		       lat_class_name(r - LAT_CLASS(0)), "");
+	    printf("%9.0f%9.0f%9.0f%9.0f%10.0f   %s\n",
+		   s->p50, s->p90, s->p99, s->p999, s->max,
+		   r == LAT_ALL && !foption ? default_tracefiles[i] : "");
+	}
+    }
+}
+
+/*
+ * printdist - prints the median, MAD and 95% confidence interval of the
+ *    timed runs behind each trace's throughput, as measured with -R
+ */
+static void printdist(int n, stats_t *stats)
+{
+    int i;
+    fsecs_dist_t *d;
+
+    printf("%5s%7s%9s%11s%11s%11s%11s%7s%8s   %s\n",
+	   "id", "valid", "Kops", "median", "MAD", "CI low", "CI high",
+	   "runs", "+/-%", "Trace");
+    for (i=0; i < n; i++) {
+	d = &stats[i].dist;
+	if (!stats[i].valid) {
+	    printf("%2d%10s%9s%11s%11s%11s%11s%7s%8s   %s\n",
+		   i, "no", "-", "-", "-", "-", "-", "-", "-",
+		   foption ? "" : default_tracefiles[i]);
+	    continue;
+	}
+	printf("%2d%10s%9.0f%11.1f%11.1f%11.1f%11.1f%7d%8.2f   %s\n",
+	       i, "yes", (stats[i].ops/1e3)/d->median,
+	       d->median*1e6, d->mad*1e6, d->ci_lo*1e6, d->ci_hi*1e6, d->samples,
+	       100 * (d->ci_hi - d->ci_lo) / 2 / d->median,
+	       foption ? "" : default_tracefiles[i]);
+    }
+}
+
+/*
+ * printcounters - prints the CPU events per op counted with -P, from
+ *    the hardware counters if we could open them and the software ones
+ *    otherwise
+ */
+static void printcounters(int n, stats_t *stats)
+{
+    int i, e, software = -1;
+    pc_counts_t *pc;
+
+    for (i = 0; i < n; i++)
+	if (stats[i].valid && stats[i].pc.mask != 0) {
+	    software = stats[i].pc.software;
+	    break;
+	}
+    if (software < 0) {
+	printf("Event counters are not available on this system.\n");
+	return;
+    }
+    printf("%s counters for %s, per op%s:\n",
+	   software ? "Software" : "Hardware", engines[0]->desc,
+	   software ? " (hardware counters are not available)" : "");
+
+    printf("%5s%7s%9s", "id", "valid", "Kops");
+    for (e = 0; e < PC_EVENTS && pc_event_name(software, e); e++)
+	printf("%9s", pc_event_name(software, e));
+    if (!software)
+	printf("%7s", "IPC");
+    printf("   %s\n", "Trace");
+
+    for (i = 0; i < n; i++) {
+	pc = &stats[i].pc;
+	if (!stats[i].valid)
+	    printf("%2d%10s%9s", i, "no", "-");
+	else
+	    printf("%2d%10s%9.0f", i, "yes", (stats[i].ops/1e3)/stats[i].secs);
+	for (e = 0; e < PC_EVENTS && pc_event_name(software, e); e++) {
+	    if (stats[i].valid && (pc->mask & (1u << e)))
+		printf("%9.2f", pc->val[e]);
+	    else
+		printf("%9s", "-");
+	}
+	if (!software) {
+	    if (stats[i].valid && (pc->mask & (1u << PC_CYCLES)) &&
+		(pc->mask & (1u << PC_INSTR)))
+		printf("%7.2f", pc->val[PC_INSTR] / pc->val[PC_CYCLES]);
+	    else
+		printf("%7s", "-");
+	}
+	printf("   %s\n", foption ? "" : default_tracefiles[i]);
+    }
+}
+
+/*
+ * printsearch - prints, for each trace, how many blocks mm.c's searches
+ *    examined (mean, max, and a histogram in powers of two, as a share
+ *    of the searches) and how many neighbors its coalesces merged, over
+ *    the run that measured utilization
+ */
+static void printsearch(int n, stats_t *stats)
+{
+    int i, b, top = 1;
+    mm_search_t *s;
+    char buf[48];
+
+    for (i = 0; i < n; i++)
+	for (b = top + 1; b < MM_SEARCH_BUCKETS; b++)
+	    if (stats[i].valid && stats[i].search.hist[b])
+		top = b;
+
+    printf("%5s%7s%9s%10s%8s%8s%11s%7s%7s%7s%7s   %s\n",
+	   "id", "valid", "Kops", "searches", "mean", "max",
+	   "coalesces", "0", "1", "2", "mean", "Trace");
+    for (i = 0; i < n; i++) {
+	s = &stats[i].search;
+	if (!stats[i].valid) {
+	    printf("%2d%10s%9s%10s%8s%8s%11s%7s%7s%7s%7s   %s\n",
+		   i, "no", "-", "-", "-", "-", "-", "-", "-", "-", "-",
+		   foption ? "" : default_tracefiles[i]);
+	    continue;
+	}
+	printf("%2d%10s%9.0f%10lu%8.1f%8lu%11lu", i, "yes",
+	       (stats[i].ops/1e3)/stats[i].secs, (unsigned long)s->searches,
+	       s->searches ? (double)s->examined / s->searches : 0,
+	       (unsigned long)s->max_examined, (unsigned long)s->coalesces);
+	for (b = 0; b < 3; b++)
+	    printf("%6.1f%%", s->coalesces ? 100.0 * s->merges[b] / s->coalesces : 0);
+	printf("%7.2f   %s\n", s->coalesces ?
+	       (double)(s->merges[1] + 2 * s->merges[2]) / s->coalesces : 0,
+	       foption ? "" : default_tracefiles[i]);
+    }
+
+    printf("\nBlocks examined per search, as a share of the searches:\n");
+    printf("%5s", "id");
+    for (b = 0; b <= top; b++) {
+	if (b < 2)
+	    sprintf(buf, "%d", b);
+	else if (b == MM_SEARCH_BUCKETS - 1)
+	    sprintf(buf, "%lu+", 1UL << (b - 1));
+	else
+	    sprintf(buf, "%lu-%lu", 1UL << (b - 1), (1UL << b) - 1);
+	printf("%10s", buf);
+    }
+    printf("   %s\n", "Trace");
+    for (i = 0; i < n; i++) {
+	s = &stats[i].search;
+	printf("%2d ", i);
+	for (b = 0; b <= top; b++) {
+	    if (!stats[i].valid || s->searches == 0)
+		printf("%10s", "-");
+	    else
+		printf("%9.1f%%", 100.0 * s->hist[b] / s->searches);
+	}
+	printf("   %s\n", foption ? "" : default_tracefiles[i]);
+    }
+}
+
+#ifdef MM_PROFILE
+/*
+ * printprofile - prints where an -DMM_PROFILE build of mm.c spent its
+ *    time over each trace's timed runs: calls and ticks per call for
+ *    each phase, and each phase's share of the time in mm_malloc and
+ *    mm_free together
+ */
+static void printprofile(int n, stats_t *stats)
+{
+    int i, p;
+    mm_profile_t *pr;
+    double total;
+
+    printf("%5s%7s%9s  %-12s%11s%10s%8s   %s\n",
+	   "id", "valid", "Kops", "phase", "calls", "ticks", "share", "Trace");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%10s%9s  %-12s%11s%10s%8s   %s\n",
+		   i, "no", "-", "-", "-", "-", "-",
+		   foption ? "" : default_tracefiles[i]);
+	    continue;
+	}
+	pr = &stats[i].prof;
+	total = (double)pr->cycles[MM_PROF_MALLOC] + pr->cycles[MM_PROF_FREE];
+	for (p = 0; p < MM_PROF_PHASES; p++) {
+	    if (p == 0)
+		printf("%2d%10s%9.0f", i, "yes", (stats[i].ops/1e3)/stats[i].secs);
+	    else
+		printf("%21s", "");
+	    printf("  %-12s%11lu", mm_profile_name(p), (unsigned long)pr->calls[p]);
+	    if (pr->calls[p] == 0)
+		printf("%10s%8s", "-", "-");
+	    else
+		printf("%10.1f%7.1f%%", (double)pr->cycles[p] / pr->calls[p],
+		       total > 0 ? 100 * pr->cycles[p] / total : 0);
+	    printf("   %s\n", p == 0 && !foption ? default_tracefiles[i] : "");
+	}
+    }
+}
+#endif
+
+/*****************************************************************
+ * The following routines measure libc's throughput on this host and
+ * keep it in a calibration file, for the perf index to be scaled by
+ ****************************************************************/
+
+/*
+ * calibrate_libc - Time the libc engine over the traces, as eval_mm_speed
+ *     times any engine; returns its ops/sec over all of them
+ */
+static double calibrate_libc(char **tracefiles, int n)
+{
+    allocator_t *a = alloc_find("libc");
+    trace_stream_t *trace;
+    speed_t speed_params;
+    fsecs_dist_t dist;
+    idmap_t *ids;
+    double secs = 0, ops = 0;
+    int i;
+
+    if (verbose > 1)
+	printf("Calibrating against %s\n", a->desc);
+    for (i = 0; i < n; i++) {
+	trace = trace_stream_open(tracedir, tracefiles[i], window);
+	ids = idmap_create(trace_stream_hdr(trace)->num_ids);
+	speed_params.alloc = a;
+	speed_params.stream = trace;
+	speed_params.ids = ids;
+	secs += time_speed(eval_mm_speed, &speed_params, &dist);
+	ops += trace_stream_hdr(trace)->num_ops;
+	stop_engine(a, ids);
+	idmap_destroy(ids);
+	trace_stream_close(trace);
+    }
+    return ops / secs;
+}
+
+/*
+ * trace_list - The trace names joined by commas, as a calibration is
+ *     tagged with them
+ */
+static void trace_list(char **tracefiles, int n, char *buf, size_t size)
+{
+    int i;
+
+    buf[0] = '\0';
+    for (i = 0; i < n; i++) {
+	if (strlen(buf) + strlen(tracefiles[i]) + 2 > size)
+	    break;
+	strcat(buf, i ? "," : "");
+	strcat(buf, tracefiles[i]);
+    }
+}
+
+/*
+ * write_calibration - Save libc's throughput with the machine's details
+ *     and the traces it was measured on, as "key=value" lines
+ */
+static void write_calibration(char *path, char **tracefiles, int n,
+			      double thruput)
+{
+    char *keys[32], vals[32][MAXLINE], traces[MAXLINE];
+    int i, m;
+    FILE *fp;
+
+    if ((fp = fopen(path, "w")) == NULL) {
+	sprintf(msg, "Could not open %s for writing", path);
+	unix_error(msg);
+    }
+    fprintf(fp, "# libc malloc's throughput on this host (mdriver --calibrate)\n");
+    m = getmeta(keys, vals, 32);
+    for (i = 0; i < m; i++)
+	fprintf(fp, "%s=%s\n", keys[i], vals[i]);
+    trace_list(tracefiles, n, traces, sizeof(traces));
+    fprintf(fp, "traces=%s\nlibc_thruput=%.10g\n", traces, thruput);
+    if (fclose(fp) != 0) {
+	sprintf(msg, "Could not write %s", path);
+	unix_error(msg);
+    }
+}
+
+/*
+ * read_calibration - libc's throughput as saved in path, or 0 if there
+ *     is no such file. A calibration made on another host or on other
+ *     traces is still used, with a warning.
+ */
+static double read_calibration(char *path, char **tracefiles, int n)
+{
+    char line[16*MAXLINE], traces[MAXLINE], host[MAXLINE], *val;
+    double thruput = 0;
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL)
+	return 0;
+    trace_list(tracefiles, n, traces, sizeof(traces));
+    if (gethostname(host, sizeof(host)) != 0)
+	host[0] = '\0';
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	line[strcspn(line, "\r\n")] = '\0';
+	if (line[0] == '#' || (val = strchr(line, '=')) == NULL)
+	    continue;
+	*val++ = '\0';
+	if (!strcmp(line, "libc_thruput"))
+	    thruput = atof(val);
+	else if (!strcmp(line, "host") && strcmp(val, host) != 0)
+	    printf("Warning: %s was calibrated on %s, not this host\n",
+		   path, val);
+	else if (!strcmp(line, "traces") && strcmp(val, traces) != 0)
+	    printf("Warning: %s was calibrated on other traces (%s)\n",
+		   path, val);
+    }
+    fclose(fp);
+    if (thruput <= 0) {
+	sprintf(msg, "%s has no libc_thruput; run with --calibrate", path);
+	app_error(msg);
+    }
+    return thruput;
+}
+
+/*****************************************************************
+ * The following routines write the results in machine-readable form
+ * and compare them with the results of an earlier run
+ ****************************************************************/
+
+/*
+ * results_to_stdout - Keep the real stdout for the results files named
+ *     "-" and send everything else the driver prints to stderr, so
+ *     that the results can be piped into another program
+ */
+static void results_to_stdout(void)
+{
+    int fd;
+
+    fflush(stdout);
+    if ((fd = dup(STDOUT_FILENO)) < 0 || 
+	(results_out = fdopen(fd, "w")) == NULL)
+	unix_error("Could not keep stdout for the results");
+    if (dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+	unix_error("Could not send the report to stderr");
+}
+
+/*
+ * open_output - Open a results file for writing; "-" is stdout
+ */
+static FILE *open_output(char *path)
+{
+    FILE *fp;
+
+    if (!strcmp(path, "-"))
+	return results_out;
+    if ((fp = fopen(path, "w")) == NULL) {
+	sprintf(msg, "Could not open %s for writing", path);
+	unix_error(msg);
+    }
+    return fp;
+}
+
+/*
+ * close_output - Close what open_output opened
+ */
+static void close_output(FILE *fp, char *path)
+{
+    if (fp == results_out) {
+	fflush(fp);
+	return;
+    }
+    if (fclose(fp) != 0) {
+	sprintf(msg, "Could not write %s", path);
+	unix_error(msg);
+    }
+}
+
+/*
+ * getmeta - Describe the machine and the run: fills in up to max
+ *     key/value pairs and returns how many
+ */
+static int getmeta(char *keys[], char vals[][MAXLINE], int max)
+{
+    struct utsname u;
+    time_t now = time(NULL);
+    char line[MAXLINE], *p;
+    FILE *fp;
+    int n = 0;
+
+#define META(k, ...) \
+    do { if (n < max) { keys[n] = (k); \
+	 snprintf(vals[n], MAXLINE, __VA_ARGS__); n++; } } while (0)
+
+    strftime(line, sizeof(line), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    META("date", "%s", line);
+    if (gethostname(line, sizeof(line)) == 0)
+	META("host", "%s", line);
+    if (uname(&u) == 0) {
+	META("os", "%s %s", u.sysname, u.release);
+	META("arch", "%s", u.machine);
+    }
+    if ((fp = fopen("/proc/cpuinfo", "r")) != NULL) {
+	while (fgets(line, sizeof(line), fp) != NULL) {
+	    if (strncmp(line, "model name", 10) == 0 &&
+		(p = strchr(line, ':')) != NULL) {
+		p[strcspn(p, "\n")] = '\0';
+		META("cpu", "%s", p + 2);
+		break;
+	    }
+	}
+	fclose(fp);
+    }
+    META("cpus", "%ld", sysconf(_SC_NPROCESSORS_ONLN));
+    META("compiler", "%s", __VERSION__);
+    META("timer", "%s", USE_FCYC && counter_available() ? "cycle counter" :
+	 USE_ITIMER ? "interval timer" : "gettimeofday");
+    META("command", "%s", cmdline);
+    META("tracedir", "%s", tracedir);
+    /* The configured size, as with -j this process has no heap */
+    META("max_heap", "%lu", (unsigned long)mem_get_max_heap());
+#undef META
+    return n;
+}
+
+/*
+ * json_string - Write s as a JSON string
+ */
+static void json_string(FILE *fp, char *s)
+{
+    fputc('"', fp);
+    for (; *s; s++) {
+	if (*s == '"' || *s == '\\')
+	    fprintf(fp, "\\%c", *s);
+	else if ((unsigned char)*s < 0x20)
+	    fprintf(fp, "\\u%04x", *s);
+	else
+	    fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+/*
+ * json_number - Write x as a JSON number (null if it is infinite or NaN)
+ */
+static void json_number(FILE *fp, double x)
+{
+    if (isfinite(x))
+	fprintf(fp, "%.10g", x);
+    else
+	fprintf(fp, "null");
+}
+
+/*
+ * lat_row_name - Name of row r of the -L latency percentiles, for
+ *     use as a key or column name
+ */
+static char *lat_row_name(int r, char *buf)
+{
+    char *c;
+
+    if (r == LAT_ALL)
+	return "all";
+    if (r == LAT_MALLOC)
+	return "malloc";
+    if (r == LAT_FREE)
+	return "free";
+    c = lat_class_name(r - LAT_CLASS(0));
+    if (c[0] == '<')
+	sprintf(buf, "le%s", c + 2);
+    else
+	sprintf(buf, "gt%s", c + 1);
+    return buf;
+}
+
+/*
+ * flatten - Lay out every field of a stats_t as named columns;
+ *     returns the number of columns
+ */
+static int flatten(stats_t *s, char names[][32], double *vals)
+{
+    static char *lat_fields[] = {"n", "p50", "p90", "p99", "p999", "max"};
+    char buf[16];
+    double *lat;
+    int r, f, n = 0;
+
+#define COL(name, val) \
+    do { strcpy(names[n], (name)); vals[n] = (val); n++; } while (0)
+
+    COL("ops", s->ops);
+    COL("valid", s->valid);
+    COL("secs", s->secs);
+    COL("util", s->util);
+    COL("thp_secs", s->thp_secs);
+    COL("dist_median", s->dist.median);
+    COL("dist_mad", s->dist.mad);
+    COL("dist_ci_lo", s->dist.ci_lo);
+    COL("dist_ci_hi", s->dist.ci_hi);
+    COL("dist_samples", s->dist.samples);
+    for (r = 0; r < LAT_ROWS; r++) {
+	lat = &s->lat[r].n;
+	for (f = 0; f < 6; f++) {
+	    snprintf(names[n], 32, "lat_%s_%s", lat_row_name(r, buf),
+		     lat_fields[f]);
+	    vals[n++] = lat[f];
+	}
+    }
+    COL("search_mean", s->search.searches ?
+	(double)s->search.examined / s->search.searches : 0);
+    COL("search_max", s->search.max_examined);
+    COL("merge_mean", s->search.coalesces ?
+	(double)(s->search.merges[1] + 2 * s->search.merges[2]) /
+	s->search.coalesces : 0);
+    COL("pc_software", s->pc.software);
+    COL("pc_mask", s->pc.mask);
+    for (r = 0; r < PC_EVENTS; r++) {
+	sprintf(buf, "pc_%d", r);
+	COL(buf, s->pc.val[r]);
+    }
+#undef COL
+    return n;
+}
+
+/*
+ * write_json_stats - Write one allocator's results as a JSON array
+ */
+static void write_json_stats(FILE *fp, char **tracefiles, int n, 
+			     stats_t *stats)
+{
+    static char *lat_fields[] = {"n", "p50", "p90", "p99", "p999", "max"};
+    char buf[32];
+    double *lat;
+    stats_t *s;
+    int i, r, f;
+
+    fprintf(fp, "[");
+    for (i = 0; i < n; i++) {
+	s = &stats[i];
+	fprintf(fp, "%s\n    {\"trace\": ", i ? "," : "");
+	json_string(fp, tracefiles[i]);
+	fprintf(fp, ", \"valid\": %s, \"ops\": ", s->valid ? "true" : "false");
+	json_number(fp, s->ops);
+	fprintf(fp, ", \"secs\": ");
+	json_number(fp, s->secs);
+	fprintf(fp, ", \"util\": ");
+	json_number(fp, s->util);
+	fprintf(fp, ", \"thp_secs\": ");
+	json_number(fp, s->thp_secs);
+	fprintf(fp, ",\n     \"dist\": {\"median\": ");
+	json_number(fp, s->dist.median);
+	fprintf(fp, ", \"mad\": ");
+	json_number(fp, s->dist.mad);
+	fprintf(fp, ", \"ci_lo\": ");
+	json_number(fp, s->dist.ci_lo);
+	fprintf(fp, ", \"ci_hi\": ");
+	json_number(fp, s->dist.ci_hi);
+	fprintf(fp, ", \"samples\": %d},\n     \"latency\": {", s->dist.samples);
+	for (r = 0; r < LAT_ROWS; r++) {
+	    fprintf(fp, "%s\"%s\": {", r ? ", " : "", lat_row_name(r, buf));
+	    lat = &s->lat[r].n;
+	    for (f = 0; f < 6; f++) {
+		fprintf(fp, "%s\"%s\": ", f ? ", " : "", lat_fields[f]);
+		json_number(fp, lat[f]);
+	    }
+	    fprintf(fp, "}");
+	}
+	fprintf(fp, "},\n     \"search\": {\"searches\": %lu, \"examined\": %lu, "
+		"\"max\": %lu, \"coalesces\": %lu, \"merges\": [%lu, %lu, %lu]",
+		(unsigned long)s->search.searches,
+		(unsigned long)s->search.examined,
+		(unsigned long)s->search.max_examined,
+		(unsigned long)s->search.coalesces,
+		(unsigned long)s->search.merges[0],
+		(unsigned long)s->search.merges[1],
+		(unsigned long)s->search.merges[2]);
+	fprintf(fp, "},\n     \"counters\": {\"set\": \"%s\"",
+		s->pc.mask == 0 ? "none" : 
+		s->pc.software ? "software" : "hardware");
+	for (r = 0; r < PC_EVENTS; r++) {
+	    if (!(s->pc.mask & (1u << r)))
+		continue;
+	    fprintf(fp, ", \"%s\": ", pc_event_name(s->pc.software, r));
+	    json_number(fp, s->pc.val[r]);
+	}
+	fprintf(fp, "}}");
+    }
+    fprintf(fp, "\n  ]");
+}
+
+/*
+ * write_json - Write the metadata, the summary and every stats_t field
+ *     of every trace as one JSON object, with a member for each engine
+ */
+static void write_json(char *path, char **tracefiles, int n, 
+		       stats_t **stats, summary_t *sum)
+{
+    char *keys[32], vals[32][MAXLINE];
+    int i, m;
+    FILE *fp = open_output(path);
+
+    fprintf(fp, "{\n  \"meta\": {");
+    m = getmeta(keys, vals, 32);
+    for (i = 0; i < m; i++) {
+	fprintf(fp, "%s\n    \"%s\": ", i ? "," : "", keys[i]);
+	json_string(fp, vals[i]);
+    }
+    fprintf(fp, "\n  },\n  \"summary\": {\"errors\": %d, \"correct\": %d, "
+	    "\"util\": ", errors, sum->correct);
+    json_number(fp, sum->util);
+    fprintf(fp, ", \"thruput\": ");
+    json_number(fp, sum->thruput);
+    fprintf(fp, ", \"util_score\": ");
+    json_number(fp, sum->util_score);
+    fprintf(fp, ", \"thru_score\": ");
+    json_number(fp, sum->thru_score);
+    fprintf(fp, ", \"perfindex\": ");
+    json_number(fp, sum->perfindex);
+    fprintf(fp, ", \"thru_ref\": ");
+    json_number(fp, sum->thru_ref);
+    fprintf(fp, ", \"thru_raw\": ");
+    json_number(fp, sum->thru_raw);
+    fprintf(fp, ", \"engine\": ");
+    json_string(fp, engines[0]->name);
+    fprintf(fp, "}");
+    for (i = 0; i < num_engines; i++) {
+	fprintf(fp, ",\n  ");
+	json_string(fp, engines[i]->name);
+	fprintf(fp, ": ");
+	write_json_stats(fp, tracefiles, n, stats[i]);
+    }
+    fprintf(fp, "\n}\n");
+    close_output(fp, path);
+}
+
+/*
+ * write_csv - Write every stats_t field of every trace as one CSV row
+ *     per trace and allocator, after the metadata and summary as
+ *     "# key=value" comment lines
+ */
+static void write_csv(char *path, char **tracefiles, int n, 
+		      stats_t **stats, summary_t *sum)
+{
+    char *keys[32], vals[32][MAXLINE];
+    char names[CSV_FIELDS][32];
+    double row[CSV_FIELDS];
+    int i, j, e, m;
+    FILE *fp = open_output(path);
+
+    m = getmeta(keys, vals, 32);
+    for (i = 0; i < m; i++)
+	fprintf(fp, "# %s=%s\n", keys[i], vals[i]);
+    fprintf(fp, "# errors=%d\n# correct=%d\n# util=%.10g\n# thruput=%.10g\n"
+	    "# perfindex=%.10g\n# thru_ref=%.10g\n# thru_raw=%.10g\n"
+	    "# engine=%s\n", errors, sum->correct, sum->util, sum->thruput,
+	    sum->perfindex, sum->thru_ref, sum->thru_raw, engines[0]->name);
+
+    m = flatten(stats[0], names, row);
+    fprintf(fp, "alloc,trace");
+    for (j = 0; j < m; j++)
+	fprintf(fp, ",%s", names[j]);
+    fprintf(fp, "\n");
+    for (e = 0; e < num_engines; e++) {
+	for (i = 0; i < n; i++) {
+	    m = flatten(&stats[e][i], names, row);
+	    fprintf(fp, "%s,%s", engines[e]->name, tracefiles[i]);
+	    for (j = 0; j < m; j++)
+		fprintf(fp, ",%.10g", row[j]);
+	    fprintf(fp, "\n");
+	}
+    }
+    close_output(fp, path);
+}
+
+/* One trace's results for the scored engine from a --baseline file */
+typedef struct {
+    char trace[MAXLINE];
+    double ops, valid, secs, util, ci_lo, ci_hi, samples;
+} baseline_t;
+
+/*
+ * split_csv - Split a CSV line in place; returns the number of fields
+ */
+static int split_csv(char *line, char **fields, int max)
+{
+    int n = 0;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    while (n < max) {
+	fields[n++] = line;
+	if ((line = strchr(line, ',')) == NULL)
+	    break;
+	*line++ = '\0';
+    }
+    return n;
+}
+
+/*
+ * read_baseline - Read the rows of a --csv file for the first engine;
+ *     returns how many there were and sets *rows to them
+ */
+static int read_baseline(char *path, baseline_t **rows)
+{
+    static char *want[] = {"alloc", "trace", "ops", "valid", "secs", "util",
+			   "dist_ci_lo", "dist_ci_hi", "dist_samples"};
+    int col[9], i, j, nf, n = 0, max = 0, header = 1;
+    char line[16*MAXLINE], *f[CSV_FIELDS];
+    baseline_t *b = NULL;
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open baseline %s", path);
+	unix_error(msg);
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	if (line[0] == '#' || line[0] == '\n')
+	    continue;
+	nf = split_csv(line, f, CSV_FIELDS);
+	if (header) {
+	    for (j = 0; j < 9; j++) {
+		for (i = 0; i < nf && strcmp(f[i], want[j]); i++)
+		    ;
+		if (i == nf) {
+		    sprintf(msg, "Baseline %s has no %s column", path, want[j]);
+		    app_error(msg);
+		}
+		col[j] = i;
+	    }
+	    header = 0;
+	    continue;
+	}
+	if (nf <= col[8] || strcmp(f[col[0]], engines[0]->name))
+	    continue;
+	if (n == max) {
+	    max = max ? 2*max : 16;
+	    if ((b = (baseline_t *)realloc(b, max * sizeof(baseline_t))) == NULL)
+		unix_error("realloc failed in read_baseline");
+	}
+	snprintf(b[n].trace, MAXLINE, "%s", f[col[1]]);
+	b[n].ops = atof(f[col[2]]);
+	b[n].valid = atof(f[col[3]]);
+	b[n].secs = atof(f[col[4]]);
+	b[n].util = atof(f[col[5]]);
+	b[n].ci_lo = atof(f[col[6]]);
+	b[n].ci_hi = atof(f[col[7]]);
+	b[n].samples = atof(f[col[8]]);
+	n++;
+    }
+    fclose(fp);
+    *rows = b;
+    return n;
+}
+
+/*
+ * compare_baseline - Print each trace's throughput and utilization
+ *     next to those of a --csv file from an earlier -R run. This run
+ *     is timed with -R too, and a throughput change is significant if
+ *     the confidence intervals of the two runs don't overlap. Returns
+ *     1 if some trace lost more than the threshold of its throughput
+ *     (significantly) or utilization, or stopped being valid.
+ */
+static int compare_baseline(char *path, char **tracefiles, int n,
+			    stats_t *mm_stats)
+{
+    baseline_t *rows, *b;
+    stats_t *s;
+    int i, j, nrows, sig, bad, regressed = 0;
+    double kops, bkops, dthru, dutil;
+
+    nrows = read_baseline(path, &rows);
+    for (j = 0; j < nrows; j++) {
+	if (rows[j].valid && rows[j].samples == 0) {
+	    sprintf(msg, "%s has no confidence intervals to compare "
+		    "throughput with; make it with -R", path);
+	    app_error(msg);
+	}
+    }
+    printf("Comparison with baseline %s (regression threshold %.1f%%):\n",
+	   path, threshold * 100);
+    printf("%5s%10s%10s%8s%10s%7s%8s%6s   %s\n", "id", "base Kops", "Kops",
+	   "delta", "base util", "util", "delta", "", "Trace");
+    for (i = 0; i < n; i++) {
+	s = &mm_stats[i];
+	for (j = 0, b = NULL; j < nrows && b == NULL; j++)
+	    if (!strcmp(rows[j].trace, tracefiles[i]))
+		b = &rows[j];
+	if (b == NULL || !b->valid) {
+	    printf("%2d%44s%s   %s\n", i, "", 
+		   b ? "  (baseline was not valid)" : "  (not in baseline)",
+		   tracefiles[i]);
+	    continue;
+	}
+	if (!s->valid) {
+	    printf("%2d%10.0f%10s%8s%9.0f%%%7s%8s%6s   %s\n", i,
+		   (b->ops/1e3)/b->secs, "-", "-", b->util*100, "-", "-",
+		   "FAIL", tracefiles[i]);
+	    regressed = 1;
+	    continue;
+	}
+	kops = (s->ops/1e3)/s->secs;
+	bkops = (b->ops/1e3)/b->secs;
+	dthru = kops/bkops - 1;
+	dutil = b->util > 0 ? s->util/b->util - 1 : 0;
+	if (fabs(dutil) < 1e-9) /* the same, up to rounding in the file */
+	    dutil = 0;
+	sig = (s->dist.ci_lo > b->ci_hi || s->dist.ci_hi < b->ci_lo);
+	bad = (sig && dthru < -threshold) || dutil < -threshold;
+	regressed |= bad;
+	printf("%2d%10.0f%10.0f%+7.1f%%%c%8.0f%%%6.0f%%%+7.1f%%%6s   %s\n",
+	       i, bkops, kops, dthru*100, sig ? '*' : ' ', b->util*100,
+	       s->util*100, dutil*100, bad ? "WORSE" : "", tracefiles[i]);
+    }
+    printf("(* marks throughput changes beyond the run-to-run noise)\n");
+    if (regressed)
+	printf("Regressed by more than %.1f%% against %s\n", 
+	       threshold * 100, path);
+    free(rows);
+    return regressed;
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1021,12 +3074,57 @@ void unix_error(char *msg)
 }
 
 /*
- * malloc_error - Report an error returned by the mm_malloc package
+ * add_engine - Add the named engine to those evaluated, once
+ */
+static void add_engine(char *name)
+{
+    allocator_t *a;
+    int i;
+
+    if ((a = alloc_find(name)) == NULL) {
+	sprintf(msg, "Unknown engine: %s (have", name);
+	for (i = 0; alloc_get(i) != NULL; i++)
+	    sprintf(msg + strlen(msg), " %s", alloc_get(i)->name);
+	strcat(msg, ")");
+	app_error(msg);
+    }
+    for (i = 0; i < num_engines; i++)
+	if (engines[i] == a)
+	    return;
+    if (num_engines == ALLOC_MAX)
+	app_error("Too many engines");
+    engines[num_engines++] = a;
+}
+
+/*
+ * malloc_error - Report an error returned by the mm_malloc package at
+ *     request opnum (origin 0) of the trace; binary, streamed and
+ *     per-thread traces have no line to point at
  */
 void malloc_error(int tracenum, int opnum, char *msg)
 {
     errors++;
-    printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
+    printf("ERROR [trace %d, op %d]: %s\n", tracenum, opnum, msg);
+}
+
+/*
+ * parse_size - Parse a byte count with an optional K, M or G suffix
+ */
+static size_t parse_size(char *str)
+{
+    char *end;
+    size_t size = strtoull(str, &end, 10);
+
+    switch (*end) {
+    case 'g': case 'G': size <<= 10; /* fall through */
+    case 'm': case 'M': size <<= 10; /* fall through */
+    case 'k': case 'K': size <<= 10; end++; break;
+    }
+    if (end == str || *end != '\0' || size == 0) {
+	sprintf(msg, "Bad size: %s", str);
+	app_error(msg);
+    }
+    return size;
 }
 
 /* 
@@ -1034,15 +3132,41 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hcvVglHLPRsS] [-a <engines>] [-f <file>] [-t <dir>] [-F <n>] [-M <size>] [-j <n>] [-T <n>] [-W <n>]\n");
+    fprintf(stderr, "               [--json <file>] [--csv <file>] [--baseline <file>] [--threshold <pct>]\n");
+    fprintf(stderr, "               [--calibrate] [--calibration <file>] [--heap-file <file>]\n");
     fprintf(stderr, "Options\n");
-    /* BSK: no teams */
-    //fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-a <list>  Evaluate the comma-separated engines, scoring the first (default mm).\n");
+    fprintf(stderr, "\t-c         Check each payload is intact when it is freed and at the end of its trace.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-F <n>     Write each trace's heap fragmentation every <n> ops to <trace>.frag.csv.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
-    fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-H         Compare throughput with and without huge pages.\n");
+    fprintf(stderr, "\t-j <n>     Evaluate traces in <n> worker processes, one per CPU.\n");
+    fprintf(stderr, "\t-l         Run libc malloc as well (same as adding libc to -a).\n");
+    fprintf(stderr, "\t-L         Report per-request latency percentiles.\n");
+    fprintf(stderr, "\t-M <size>  Simulated heap size, e.g. 64M or 8G (default %dM).\n",
+	    MAX_HEAP >> 20);
+    fprintf(stderr, "\t-P         Count cache, TLB and branch misses per op (perf_event_open).\n");
+    fprintf(stderr, "\t-R         Time by the median of runs, sampling until its 95%% CI is within %g%%.\n",
+	    FSECS_CI_TARGET * 100);
+    fprintf(stderr, "\t-s         Report blocks examined per search and merges per coalesce in mm.c.\n");
+    fprintf(stderr, "\t-S         Stream traces in windows of %d ops instead of loading them.\n",
+	    STREAM_WINDOW);
+    fprintf(stderr, "\t-T <n>     Replay each trace on 1..<n> threads, one per trace thread.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-W <n>     Warmup runs before each -R measurement (default %d).\n",
+	    FSECS_WARMUP);
+    fprintf(stderr, "\t--json <file>      Write every result and the run's metadata as JSON (- for stdout).\n");
+    fprintf(stderr, "\t--csv <file>       Write the same as CSV, one row per trace.\n");
+    fprintf(stderr, "\t--baseline <file>  Compare with an earlier -R --csv file, timing with -R; exit 2 on a regression.\n");
+    fprintf(stderr, "\t--threshold <pct>  Loss of throughput or util that counts as a regression (default %g).\n",
+	    REGRESS_THRESHOLD * 100);
+    fprintf(stderr, "\t--calibrate        Time libc malloc on the traces and score throughput against it from now on.\n");
+    fprintf(stderr, "\t--calibration <file>  Where --calibrate keeps that (default %s).\n",
+	    CALIBRATION_FILE);
+    fprintf(stderr, "\t--heap-file <file>    Check mm resumes a heap kept in <file>, moved halfway through each trace.\n");
 }
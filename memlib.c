@@ -2,6 +2,10 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ * Each simulated heap lives in a mem_ctx_t, so several heaps can coexist
+ * in one process. The original mem_xxx functions operate on a default
+ * context created by mem_init.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,86 +15,526 @@
 #include <string.h>
 #include <errno.h>
 #include <stdint.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "memlib.h"
 #include "config.h"
 
+/*
+ * Layout of a file-backed heap: one page holding a mem_file_t header,
+ * followed by max_heap bytes of heap. The brk is kept as a heap-relative
+ * offset so the file can be mapped back at a different address.
+ */
+#define MEM_FILE_MAGIC   0x4d454d48  /* "MEMH" */
+#define MEM_FILE_VERSION 1
+
+typedef struct {
+    uint32_t magic;      /* MEM_FILE_MAGIC */
+    uint32_t version;    /* MEM_FILE_VERSION */
+    uint64_t base;       /* address the heap was last mapped at */
+    uint64_t max_heap;   /* size of the heap area in bytes */
+    uint64_t brk_off;    /* heap-relative offset of the brk pointer */
+} mem_file_t;
+
+/* One simulated heap */
+struct mem_ctx {
+    char *start_brk;     /* points to first byte of heap */
+    char *brk;           /* points to last byte of heap */
+    char *max_addr;      /* largest legal heap address */ 
+    size_t max_heap;     /* size of the heap reservation in bytes */
+    char *commit_brk;    /* end of the committed (accessible) pages */
+    size_t commit_chunk; /* commit granularity in bytes */
+    mem_file_t *file;    /* header of a file-backed heap, else NULL */
+    size_t file_len;     /* length of the file mapping in bytes */
+};
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static mem_ctx_t *mem_ctx;            /* context behind the mem_xxx API */
+static int mem_thp = MEM_THP_DEFAULT; /* huge page policy for mem_init */
+static size_t mem_max_heap = MAX_HEAP; /* heap size for mem_init */
+
+/* Round n up to a multiple of the power of two a */
+#define MEM_ROUNDUP(n, a) (((n) + ((a)-1)) & ~((size_t)(a)-1))
 
 /* 
- * mem_init - initialize the memory system model
+ * mem_ctx_create - create a simulated heap of up to max_heap bytes using
+ *    the transparent huge page policy thp (one of the MEM_THP_xxx
+ *    constants). The whole heap
+ *    is reserved as inaccessible address space up front, aligned to a
+ *    huge page boundary; mem_ctx_sbrk commits pages only as the brk
+ *    advances. Returns NULL on error.
  */
-void mem_init(void)
+mem_ctx_t *mem_ctx_create(size_t max_heap, int thp)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
-	exit(1);
+    mem_ctx_t *ctx;
+    char *addr;
+    size_t pad;
+
+    if ((ctx = (mem_ctx_t *)calloc(1, sizeof(mem_ctx_t))) == NULL) {
+	fprintf(stderr, "mem_ctx_create: calloc error\n");
+	return NULL;
+    }
+
+    /* reserve the address space we will use to model the available VM,
+       with room to slide the start up to a huge page boundary */
+    max_heap = MEM_ROUNDUP(max_heap, MEM_HUGEPAGE_SIZE);
+    addr = mmap(NULL, max_heap + MEM_HUGEPAGE_SIZE, PROT_NONE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED) {
+	fprintf(stderr, "mem_ctx_create: mmap error: %s\n", strerror(errno));
+	free(ctx);
+	return NULL;
+    }
+    ctx->start_brk = (char *)MEM_ROUNDUP((uintptr_t)addr, MEM_HUGEPAGE_SIZE);
+    pad = ctx->start_brk - addr;
+    if (pad > 0)
+	munmap(addr, pad);
+    munmap(ctx->start_brk + max_heap, MEM_HUGEPAGE_SIZE - pad);
+
+    /* apply the transparent huge page policy to the whole reservation */
+    ctx->commit_chunk = MEM_COMMIT_CHUNK;
+#ifdef MADV_HUGEPAGE
+    if (thp == MEM_THP_ON) {
+	if (madvise(ctx->start_brk, max_heap, MADV_HUGEPAGE) == 0)
+	    ctx->commit_chunk = MEM_HUGEPAGE_SIZE;
+	else
+	    fprintf(stderr, "mem_ctx_create: huge pages unavailable: %s\n",
+		    strerror(errno));
     }
+    else if (thp == MEM_THP_OFF)
+	madvise(ctx->start_brk, max_heap, MADV_NOHUGEPAGE);
+#endif
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    ctx->max_heap = max_heap;
+    ctx->max_addr = ctx->start_brk + max_heap;  /* max legal heap address */
+    ctx->brk = ctx->start_brk;                  /* heap is empty initially */
+    ctx->commit_brk = ctx->start_brk;           /* nothing committed yet */
+    return ctx;
+}
+
+/*
+ * mem_map_file - map len bytes of fd at base. If fixed is set the
+ *    mapping must land exactly at base; otherwise base is only a hint
+ *    and the heap may be relocated.
+ */
+static void *mem_map_file(int fd, size_t len, void *base, int fixed)
+{
+    int flags = MAP_SHARED;
+    void *addr;
+
+#ifdef MAP_FIXED_NOREPLACE
+    if (fixed)
+	flags |= MAP_FIXED_NOREPLACE;
+#endif
+    addr = mmap(base, len, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if (addr == MAP_FAILED)
+	return NULL;
+    if (fixed && addr != base) {
+	munmap(addr, len);
+	errno = EEXIST;
+	return NULL;
+    }
+    return addr;
+}
+
+/*
+ * mem_ctx_create_file - create an empty simulated heap of up to max_heap
+ *    bytes backed by the file at path, which is created or truncated.
+ *    The file is sparse, so only pages the heap touches take disk
+ *    space. base is the address of
+ *    the first heap byte, or NULL for a relocatable heap. Returns NULL on
+ *    error.
+ */
+mem_ctx_t *mem_ctx_create_file(const char *path, void *base, size_t max_heap)
+{
+    mem_ctx_t *ctx;
+    int fd;
+    void *addr;
+
+    if ((ctx = (mem_ctx_t *)calloc(1, sizeof(mem_ctx_t))) == NULL) {
+	fprintf(stderr, "mem_ctx_create_file: calloc error\n");
+	return NULL;
+    }
+    max_heap = MEM_ROUNDUP(max_heap, mem_pagesize());
+    ctx->file_len = mem_pagesize() + max_heap;
+    if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+	fprintf(stderr, "mem_ctx_create_file: open %s: %s\n",
+		path, strerror(errno));
+	free(ctx);
+	return NULL;
+    }
+    if (ftruncate(fd, ctx->file_len) < 0 ||
+	(addr = mem_map_file(fd, ctx->file_len, base ? (char *)base - mem_pagesize()
+			     : NULL, base != NULL)) == NULL) {
+	fprintf(stderr, "mem_ctx_create_file: %s: %s\n", path, strerror(errno));
+	close(fd);
+	free(ctx);
+	return NULL;
+    }
+    close(fd); /* the mapping keeps the file open */
+
+    ctx->file = (mem_file_t *)addr;
+    ctx->file->magic = MEM_FILE_MAGIC;
+    ctx->file->version = MEM_FILE_VERSION;
+    ctx->file->max_heap = max_heap;
+    ctx->file->brk_off = 0;
+
+    ctx->start_brk = (char *)addr + mem_pagesize();
+    ctx->file->base = (uintptr_t)ctx->start_brk;
+    ctx->max_heap = max_heap;
+    ctx->max_addr = ctx->start_brk + max_heap;
+    ctx->brk = ctx->start_brk;
+    ctx->commit_brk = ctx->max_addr;  /* file pages are always accessible */
+    return ctx;
+}
+
+/*
+ * mem_ctx_attach - reopen a heap file written by an earlier
+ *    mem_ctx_create_file and restore its brk. With a NULL base the heap
+ *    is mapped back at its previous address if that is free, and
+ *    relocated otherwise; callers that keep raw pointers in the heap must
+ *    pass the base they used before. Returns NULL on error.
+ */
+mem_ctx_t *mem_ctx_attach(const char *path, void *base)
+{
+    mem_ctx_t *ctx;
+    int fd;
+    void *addr;
+    mem_file_t hdr;
+    struct stat st;
+
+    if ((fd = open(path, O_RDWR)) < 0) {
+	fprintf(stderr, "mem_ctx_attach: open %s: %s\n", path, strerror(errno));
+	return NULL;
+    }
+    if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	hdr.magic != MEM_FILE_MAGIC || hdr.version != MEM_FILE_VERSION ||
+	hdr.max_heap % mem_pagesize() != 0 || hdr.brk_off > hdr.max_heap) {
+	fprintf(stderr, "mem_ctx_attach: %s is not a valid heap file\n", path);
+	close(fd);
+	return NULL;
+    }
+
+    /* A heap file cut short would map, then fault past its end */
+    if (fstat(fd, &st) < 0 || hdr.max_heap > (uint64_t)st.st_size ||
+	(uint64_t)st.st_size - hdr.max_heap < mem_pagesize()) {
+	fprintf(stderr, "mem_ctx_attach: %s is truncated\n", path);
+	close(fd);
+	return NULL;
+    }
+    if ((ctx = (mem_ctx_t *)calloc(1, sizeof(mem_ctx_t))) == NULL) {
+	fprintf(stderr, "mem_ctx_attach: calloc error\n");
+	close(fd);
+	return NULL;
+    }
+
+    ctx->file_len = mem_pagesize() + hdr.max_heap;
+    if (base == NULL)
+	addr = mem_map_file(fd, ctx->file_len,
+			    (char *)(uintptr_t)hdr.base - mem_pagesize(), 0);
+    else
+	addr = mem_map_file(fd, ctx->file_len, (char *)base - mem_pagesize(), 1);
+    if (addr == NULL) {
+	fprintf(stderr, "mem_ctx_attach: %s: %s\n", path, strerror(errno));
+	close(fd);
+	free(ctx);
+	return NULL;
+    }
+    close(fd);
+
+    ctx->file = (mem_file_t *)addr;
+    ctx->start_brk = (char *)addr + mem_pagesize();
+    ctx->file->base = (uintptr_t)ctx->start_brk;
+    ctx->max_heap = hdr.max_heap;
+    ctx->max_addr = ctx->start_brk + hdr.max_heap;
+    ctx->brk = ctx->start_brk + ctx->file->brk_off;
+    ctx->commit_brk = ctx->max_addr;
+    return ctx;
 }
 
 /* 
- * mem_deinit - free the storage used by the memory system model
+ * mem_ctx_destroy - free the storage used by a simulated heap
  */
-void mem_deinit(void)
+void mem_ctx_destroy(mem_ctx_t *ctx)
 {
-    free(mem_start_brk);
+    if (ctx->file != NULL) {
+	msync(ctx->file, ctx->file_len, MS_SYNC);
+	munmap(ctx->file, ctx->file_len);
+    }
+    else
+	munmap(ctx->start_brk, ctx->max_heap);
+    free(ctx);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_commit - make the heap accessible up to at least addr, growing
+ *    the committed region in commit_chunk steps. Returns 0 on
+ *    success, -1 if the pages could not be committed.
  */
-void mem_reset_brk()
+static int mem_commit(mem_ctx_t *ctx, char *addr)
+{
+    size_t len;
+
+    if (addr <= ctx->commit_brk)
+	return 0;
+    len = MEM_ROUNDUP((size_t)(addr - ctx->commit_brk), ctx->commit_chunk);
+    if (len > (size_t)(ctx->max_addr - ctx->commit_brk))
+	len = ctx->max_addr - ctx->commit_brk;
+    if (mprotect(ctx->commit_brk, len, PROT_READ | PROT_WRITE) < 0)
+	return -1;
+    ctx->commit_brk += len;
+    return 0;
+}
+
+/*
+ * mem_decommit - return the pages above addr to the OS and make them
+ *    inaccessible again
+ */
+static void mem_decommit(mem_ctx_t *ctx, char *addr)
+{
+    size_t len;
+
+    if (addr >= ctx->commit_brk)
+	return;
+    len = ctx->commit_brk - addr;
+    madvise(addr, len, MADV_DONTNEED);
+    mprotect(addr, len, PROT_NONE);
+    ctx->commit_brk = addr;
+}
+
+/*
+ * mem_ctx_reset_brk - reset the simulated brk pointer to make an empty
+ *    heap. The committed pages are kept, so runs repeated over the same
+ *    trace don't fault the heap back in; mem_ctx_trim releases them.
+ */
+void mem_ctx_reset_brk(mem_ctx_t *ctx)
+{
+    ctx->brk = ctx->start_brk;
+    if (ctx->file != NULL)
+	ctx->file->brk_off = 0;
+}
+
+/*
+ * mem_ctx_trim - release the committed pages beyond MEM_COMMIT_WATERMARK
+ *    and above the brk, so an idle heap does not hold on to the
+ *    high-water mark of the last trace. File-backed heaps keep theirs.
+ */
+void mem_ctx_trim(mem_ctx_t *ctx)
 {
-    mem_brk = mem_start_brk;
+    char *addr = ctx->start_brk +
+	MEM_ROUNDUP(MEM_COMMIT_WATERMARK, ctx->commit_chunk);
+
+    if (ctx->file != NULL)
+	return;
+    if (addr < ctx->brk)
+	addr = ctx->start_brk +
+	    MEM_ROUNDUP((size_t)(ctx->brk - ctx->start_brk), ctx->commit_chunk);
+    mem_decommit(ctx, addr);
 }
 
 /* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
+ * mem_ctx_sbrk - simple model of the sbrk function. Extends the heap 
  *    by incr bytes and returns the start address of the new area. In
  *    this model, the heap cannot be shrunk.
  */
-void *mem_sbrk(int incr) 
+void *mem_ctx_sbrk(mem_ctx_t *ctx, size_t incr) 
 {
-    char *old_brk = mem_brk;
+    char *old_brk = ctx->brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if ( (incr > (size_t)(ctx->max_addr - ctx->brk)) ||
+	 mem_commit(ctx, ctx->brk + incr) < 0) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
-    mem_brk += incr;
+    ctx->brk += incr;
+    if (ctx->file != NULL)
+	ctx->file->brk_off = ctx->brk - ctx->start_brk;
     return (void *)old_brk;
 }
 
 /*
- * mem_heap_lo - return address of the first heap byte
+ * mem_ctx_heap_lo - return address of the first heap byte
  */
-void *mem_heap_lo()
+void *mem_ctx_heap_lo(mem_ctx_t *ctx)
 {
-    return (void *)mem_start_brk;
+    return (void *)ctx->start_brk;
 }
 
 /* 
- * mem_heap_hi - return address of last heap byte
+ * mem_ctx_heap_hi - return address of last heap byte
  */
-void *mem_heap_hi()
+void *mem_ctx_heap_hi(mem_ctx_t *ctx)
+{
+    return (void *)(ctx->brk - 1);
+}
+
+/*
+ * mem_ctx_heapsize - returns the heap size in bytes
+ */
+size_t mem_ctx_heapsize(mem_ctx_t *ctx)
+{
+    return (size_t)(ctx->brk - ctx->start_brk);
+}
+
+/*
+ * mem_ctx_heap_maxsize - returns the largest size the heap can grow to
+ */
+size_t mem_ctx_heap_maxsize(mem_ctx_t *ctx)
+{
+    return ctx->max_heap;
+}
+
+/*
+ * mem_ctx_heap_off - convert a heap address to a heap-relative offset, 
+ *    which stays valid when a file-backed heap is relocated
+ */
+size_t mem_ctx_heap_off(mem_ctx_t *ctx, void *p)
 {
-    return (void *)(mem_brk - 1);
+    return (size_t)((char *)p - ctx->start_brk);
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_ctx_heap_ptr - convert a heap-relative offset back to an address
  */
+void *mem_ctx_heap_ptr(mem_ctx_t *ctx, size_t off)
+{
+    return (void *)(ctx->start_brk + off);
+}
+
+/*
+ * mem_ctx_thp_enabled - did this heap get huge pages requested?
+ */
+int mem_ctx_thp_enabled(mem_ctx_t *ctx)
+{
+    return ctx->commit_chunk == MEM_HUGEPAGE_SIZE;
+}
+
+/*****************************************************************
+ * The mem_xxx API: thin wrappers that operate on a default context
+ ****************************************************************/
+
+/* 
+ * mem_init - initialize the memory system model
+ */
+void mem_init(void)
+{
+    if ((mem_ctx = mem_ctx_create(mem_max_heap, mem_thp)) == NULL)
+	exit(1);
+}
+
+/*
+ * mem_init_file - initialize the memory system model with an empty heap
+ *    backed by a file; see mem_ctx_create_file. Returns 0 on success,
+ *    -1 on error.
+ */
+int mem_init_file(const char *path, void *base)
+{
+    return (mem_ctx = mem_ctx_create_file(path, base, mem_max_heap)) == NULL ?
+	-1 : 0;
+}
+
+/*
+ * mem_attach - reopen a file-backed heap; see mem_ctx_attach. Returns 0
+ *    on success, -1 on error.
+ */
+int mem_attach(const char *path, void *base)
+{
+    return (mem_ctx = mem_ctx_attach(path, base)) == NULL ? -1 : 0;
+}
+
+/* 
+ * mem_deinit - free the storage used by the memory system model
+ */
+void mem_deinit(void)
+{
+    mem_ctx_destroy(mem_ctx);
+    mem_ctx = NULL;
+}
+
+/*
+ * mem_set_thp - choose the transparent huge page policy (one of the
+ *    MEM_THP_xxx constants) applied by the next mem_init
+ */
+void mem_set_thp(int mode)
+{
+    mem_thp = mode;
+}
+
+/*
+ * mem_set_max_heap - set the heap size in bytes used by the next
+ *    mem_init or mem_init_file (MAX_HEAP by default)
+ */
+void mem_set_max_heap(size_t size)
+{
+    mem_max_heap = size;
+}
+
+/*
+ * mem_get_max_heap - the heap size in bytes the next mem_init will use
+ */
+size_t mem_get_max_heap(void)
+{
+    return mem_max_heap;
+}
+
+/*
+ * mem_default_ctx - return the context behind the mem_xxx API
+ */
+mem_ctx_t *mem_default_ctx(void)
+{
+    return mem_ctx;
+}
+
+int mem_thp_enabled(void)
+{
+    return mem_ctx_thp_enabled(mem_ctx);
+}
+
+void mem_reset_brk()
+{
+    mem_ctx_reset_brk(mem_ctx);
+}
+
+void mem_trim(void)
+{
+    mem_ctx_trim(mem_ctx);
+}
+
+void *mem_sbrk(size_t incr) 
+{
+    return mem_ctx_sbrk(mem_ctx, incr);
+}
+
+void *mem_heap_lo()
+{
+    return mem_ctx_heap_lo(mem_ctx);
+}
+
+void *mem_heap_hi()
+{
+    return mem_ctx_heap_hi(mem_ctx);
+}
+
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return mem_ctx_heapsize(mem_ctx);
+}
+
+size_t mem_heap_maxsize()
+{
+    return mem_ctx_heap_maxsize(mem_ctx);
+}
+
+size_t mem_heap_off(void *p)
+{
+    return mem_ctx_heap_off(mem_ctx, p);
+}
+
+void *mem_heap_ptr(size_t off)
+{
+    return mem_ctx_heap_ptr(mem_ctx, off);
 }
 
 /*
@@ -102,7 +546,8 @@ size_t mem_pagesize()
 }
 
 void mem_heap_print(){
-    int i, size, alloc, boundary;
+    int i, alloc, boundary;
+    size_t size;
     uint64_t *addr = (uint64_t *) mem_heap_lo();
 
     printf("\nPrinting heap\n");
@@ -1,12 +1,55 @@
+#ifndef __MEMLIB_H_
+#define __MEMLIB_H_
+
 #include <unistd.h>
 
+/* Size of an x86-64/AArch64 transparent huge page */
+#define MEM_HUGEPAGE_SIZE (2*(1<<20))
+
+/* Transparent huge page policies for mem_ctx_create and mem_set_thp */
+#define MEM_THP_DEFAULT 0  /* leave it to the system setting */
+#define MEM_THP_OFF     1  /* always use base pages */
+#define MEM_THP_ON      2  /* ask for huge pages */
+
+/* A simulated heap; each context has its own brk */
+typedef struct mem_ctx mem_ctx_t;
+
+mem_ctx_t *mem_ctx_create(size_t max_heap, int thp);
+mem_ctx_t *mem_ctx_create_file(const char *path, void *base, size_t max_heap);
+mem_ctx_t *mem_ctx_attach(const char *path, void *base);
+void mem_ctx_destroy(mem_ctx_t *ctx);
+void *mem_ctx_sbrk(mem_ctx_t *ctx, size_t incr);
+void mem_ctx_reset_brk(mem_ctx_t *ctx);
+void mem_ctx_trim(mem_ctx_t *ctx);
+void *mem_ctx_heap_lo(mem_ctx_t *ctx);
+void *mem_ctx_heap_hi(mem_ctx_t *ctx);
+size_t mem_ctx_heapsize(mem_ctx_t *ctx);
+size_t mem_ctx_heap_maxsize(mem_ctx_t *ctx);
+size_t mem_ctx_heap_off(mem_ctx_t *ctx, void *p);
+void *mem_ctx_heap_ptr(mem_ctx_t *ctx, size_t off);
+int mem_ctx_thp_enabled(mem_ctx_t *ctx);
+
+/* The original single-heap API, operating on mem_default_ctx() */
 void mem_init(void);               
+int mem_init_file(const char *path, void *base);
+int mem_attach(const char *path, void *base);
 void mem_deinit(void);
-void *mem_sbrk(int incr);
+void mem_set_thp(int mode);
+void mem_set_max_heap(size_t size);
+size_t mem_get_max_heap(void);
+int mem_thp_enabled(void);
+mem_ctx_t *mem_default_ctx(void);
+void *mem_sbrk(size_t incr);
 void mem_reset_brk(void); 
+void mem_trim(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_heap_maxsize(void);
+size_t mem_heap_off(void *p);
+void *mem_heap_ptr(size_t off);
 size_t mem_pagesize(void);
 
 void mem_heap_print(void);
+
+#endif /* __MEMLIB_H_ */
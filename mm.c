@@ -20,6 +20,9 @@
 #include "mm.h"
 #include "memlib.h"
 #include "align.h"
+#ifdef MM_PROFILE
+#include "clock.h"
+#endif
 
 /* Alignment definitions
  * In align.h, there are three definitions relating to alignment.
@@ -35,55 +38,47 @@ extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 
 /* Private global variables */
-static char *mem_heap;		/* Points to first byte of heap */
-static char *mem_brk;		/* Points to last byte of heap plus 1 */
-static char *mem_max_addr;	/* Max legal heap addr plus 1*/
-static char *heap_listp;  /* Points to the prologue block */
+static mm_inst_t mm_default; /* Instance behind mm_init/mm_malloc/mm_free */
 
 /*
-* mem_init - Initialize the memory system model
-*/
-void mem_init(void)
-{
-    mem_heap = (char *)Malloc(MAX_HEAP);
-    mem_brk = (char *)mem_heap;
-    mem_max_addr = (char *)(mem_heap + MAX_HEAP);
-}
+ * PROFILE(phase, stmt) runs stmt, charging its cycles to phase in a
+ * -DMM_PROFILE build and doing nothing more otherwise
+ */
+#ifdef MM_PROFILE
+static mm_profile_t mm_prof; /* Phase times since mm_profile_reset */
 
-/*
-* mem_sbrk - Simple model of the sbrk function. Extends the heap
-*	by incr bytes and returns the start address of the new area. In
-*	this model, the heap cannot be shrunk.
-*/
-void *mem_sbrk(int incr)
-{
-    char *old_brk = mem_brk;
+#define PROFILE(phase, stmt) do { \
+        uint64_t t0_ = cycle_stamp(); \
+        stmt; \
+        mm_prof.cycles[phase] += cycle_stamp() - t0_; \
+        mm_prof.calls[phase]++; \
+    } while (0)
+#else
+#define PROFILE(phase, stmt) stmt
+#endif
 
-    if ( (incr < 0)|| ((mem_brk + incr) > mem_max_addr)) {
-        errno = ENOMEM;
-        fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
-        return (void *)–1l;
-    }
-    mem_brk += incr;
-    return (void *)old_brk;
-}
 /* Basic constants and macros */
-#define WSIZE	4	 /* Word and header/footer size (bytes) */
-#define DSIZE	8	/* Double word size (bytes) */
+#define WSIZE	HEADER_SIZE	 /* Word and header/footer size (bytes) */
+#define DSIZE	ALIGNMENT	/* Double word size (bytes) */
+#ifdef MM_HUGE_CHUNKS
+#define CHUNKSIZE MEM_HUGEPAGE_SIZE /* Extend heap in huge-page units */
+#else
 #define CHUNKSIZE (1<<12) /* Extend heap by this amount (bytes) */
+#endif
 
 #define MAX(x, y) ((x) > (y)? (x) : (y))
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc) ((size)	|	(alloc))
 
-/* Read and write a word at address p */
-#define GET(p)	(* (unsigned int *)(p))
-#define PUT(p, val)		(*(unsigned int *)(p) = (val))
+/* Read and write a word at address p; words are size_t so a header can
+   describe blocks larger than 4 GB */
+#define GET(p)	(* (size_t *)(p))
+#define PUT(p, val)		(*(size_t *)(p) = (val))
 
 /* Read the size and allocated fields from address p */
-#define GET_SIZE(p)	(GET(p) & ~0x7)
-#define GET_ALL0C(p)	(GET(p) & 0x1)
+#define GET_SIZE(p)	(GET(p) & ~(size_t)0x7)
+#define GET_ALLOC(p)	(GET(p) & 0x1)
 
 /* Given block ptr bp, compute address of its header and footer */
 #define HDRP(bp)	((char *) (bp) - WSIZE)
@@ -92,33 +87,80 @@ void *mem_sbrk(int incr)
 /* Given block ptr bp, compute address of next and previous blocks */
 #define NEXT_BLKP(bp)	((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
 #define PREV_BLKP(bp)	((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
-static void *extend_heap(size_t words); // Add the function prototype
+static void *extend_heap(mm_inst_t *mm, size_t words); // Add the function prototype
+static void *coalesce(mm_inst_t *mm, void *bp);
+static void *find_fit(mm_inst_t *mm, size_t asize);
+static void place(void *bp, size_t asize);
 
-int mm_init(void)
+/*
+ * mm_heap_valid - Does the heap already hold a prologue and epilogue
+ * laid down by an earlier mm_init, e.g. one reopened with mem_attach?
+ */
+static int mm_heap_valid(mem_ctx_t *mem)
 {
+    char *lo = mem_ctx_heap_lo(mem);
+    char *epilogue = (char *)mem_ctx_heap_hi(mem) + 1 - WSIZE;
+
+    if (mem_ctx_heapsize(mem) < 4*WSIZE)
+        return 0;
+    return GET(lo + (1*WSIZE)) == PACK(DSIZE, 1) &&
+           GET(lo + (2*WSIZE)) == PACK(DSIZE, 1) &&
+           GET(epilogue) == PACK(0, 1);
+}
+
+/*
+ * mm_inst_init - Bind an allocator instance to the heap in mem and
+ * initialize it
+ */
+int mm_inst_init(mm_inst_t *mm, mem_ctx_t *mem)
+{
+    char *heap_listp;
+
+    mm->mem = mem;
+    memset(&mm->search, 0, sizeof(mm->search));
+
+    /* Resume with an existing heap instead of rebuilding it */
+    if (mm_heap_valid(mem)) {
+        mm->heap_listp = (char *)mem_ctx_heap_lo(mem) + (2*WSIZE);
+        return 0;
+    }
+
     /* Create the initial empty heap */
-    if ((heap_listp = mem_sbrk(4*WSIZE)) == (void *)-1)
+    if ((heap_listp = mem_ctx_sbrk(mem, 4*WSIZE)) == (void *)-1)
         return -1;
     PUT(heap_listp, 0);				/* Alignment padding */
     PUT(heap_listp + (1*WSIZE), PACK(DSIZE, 1));	/* Prologue header */
     PUT(heap_listp + (2*WSIZE), PACK(DSIZE, 1));	/* Prologue footer */
     PUT(heap_listp + (3*WSIZE), PACK(0, 1));	/* Epilogue header */
     heap_listp += (2*WSIZE); // Point heap_listp to the prologue block
+    mm->heap_listp = heap_listp;
 
     /* Extend the empty heap with a free block of CHUNKSIZE bytes */
-    if (extend_heap(CHUNKSIZE/WSIZE) == NULL)
+    if (extend_heap(mm, CHUNKSIZE/WSIZE) == NULL)
         return -1;
     return 0;
 }
 
-static void *extend_heap(size_t words){
+/*
+ * mm_init - Initialize the default instance on the default heap
+ */
+int mm_init(void)
+{
+    return mm_inst_init(&mm_default, mem_default_ctx());
+}
+
+static void *extend_heap(mm_inst_t *mm, size_t words){
     char *bp;
     size_t size;
 
     /* Allocate an even number of words to maintain alignment */
     size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
-    if ((long)(bp = mem_sbrk(size)) == –1)
-    return NULL;
+#ifdef MM_HUGE_CHUNKS
+    /* Grow the heap by whole huge pages */
+    size = ((size + CHUNKSIZE-1) / CHUNKSIZE) * CHUNKSIZE;
+#endif
+    if ((bp = mem_ctx_sbrk(mm->mem, size)) == (void *)-1)
+        return NULL;
 
     /* Initialize free block header/footer and the epilogue header */
     PUT(HDRP(bp), PACK(size, 0));		/* Free block header */
@@ -126,22 +168,26 @@ static void *extend_heap(size_t words){
     PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));	/* New epilogue header */
 
     /* Coalesce if the previous block was free */
-    return coalesce(bp);
+    PROFILE(MM_PROF_COALESCE, bp = coalesce(mm, bp));
+    return bp;
 }
 
-void mm_free(void *bp)	{
+void mm_inst_free(mm_inst_t *mm, void *bp)	{
     size_t size = GET_SIZE(HDRP(bp));
 
-    PUT(HDRP(bp), PACKCsize, 0));
-    PUT(FTRPCbp), PACKCsize, 0));
-    coalesce(bp);
+    PUT(HDRP(bp), PACK(size, 0));
+    PUT(FTRP(bp), PACK(size, 0));
+    PROFILE(MM_PROF_COALESCE, coalesce(mm, bp));
 }
 
-static void *coalesce(void *bp)	{
+static void *coalesce(mm_inst_t *mm, void *bp)	{
     size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
     size_t size = GET_SIZE(HDRP(bp));
 
+    mm->search.coalesces++;
+    mm->search.merges[!prev_alloc + !next_alloc]++;
+
     if (prev_alloc && next_alloc) {			/* Case 1 */
         return bp;
     }
@@ -154,21 +200,77 @@ static void *coalesce(void *bp)	{
 
     else if (!prev_alloc && next_alloc) {		/* Case 3 */
         size += GET_SIZE(HDRP(PREV_BLKP(bp)));
-        PUT(FTRPCbp), PACKCsize, 0));
-        PUT(HDRP(PREV_BLKP(bp)), PACKCsize, 0));
+        PUT(FTRP(bp), PACK(size, 0));
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
         bp = PREV_BLKP(bp);
     }
 
     else {						/* Case 4 */
         size += GET_SIZE(HDRP(PREV_BLKP(bp))) +
                 GET_SIZE(FTRP(NEXT_BLKP(bp)));
-        PUT(HDRP(PREV_BLKP(bp)), PACKCsize, 0));
-        PUT(FTRP(NEXT_BLKP(bp)), PACKCsize, 0));
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
         bp = PREV_BLKP(bp);
     }
     return bp;
 }
-void *mm_malloc(size_t size)
+
+/*
+ * count_search - Note that a search examined n blocks
+ */
+static void count_search(mm_inst_t *mm, uint64_t n)
+{
+    int b = n == 0 ? 0 : 64 - __builtin_clzll(n);
+
+    mm->search.searches++;
+    mm->search.examined += n;
+    if (n > mm->search.max_examined)
+        mm->search.max_examined = n;
+    mm->search.hist[b < MM_SEARCH_BUCKETS ? b : MM_SEARCH_BUCKETS-1]++;
+}
+
+/*
+ * find_fit - First-fit search of the implicit list for a free block of
+ * at least asize bytes
+ */
+static void *find_fit(mm_inst_t *mm, size_t asize)
+{
+    char *bp;
+    uint64_t n = 0;
+
+    for (bp = mm->heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        n++;
+        if (!GET_ALLOC(HDRP(bp)) && asize <= GET_SIZE(HDRP(bp))) {
+            count_search(mm, n);
+            return bp;
+        }
+    }
+    count_search(mm, n);
+    return NULL;    /* No fit */
+}
+
+/*
+ * place - Place a block of asize bytes at the start of free block bp,
+ * splitting off the remainder if it is at least the minimum block size
+ */
+static void place(void *bp, size_t asize)
+{
+    size_t csize = GET_SIZE(HDRP(bp));
+
+    if ((csize - asize) >= (2*DSIZE)) {
+        PUT(HDRP(bp), PACK(asize, 1));
+        PUT(FTRP(bp), PACK(asize, 1));
+        bp = NEXT_BLKP(bp);
+        PUT(HDRP(bp), PACK(csize-asize, 0));
+        PUT(FTRP(bp), PACK(csize-asize, 0));
+    }
+    else {
+        PUT(HDRP(bp), PACK(csize, 1));
+        PUT(FTRP(bp), PACK(csize, 1));
+    }
+}
+
+void *mm_inst_malloc(mm_inst_t *mm, size_t size)
 {
     size_t asize;	/* Adjusted block size */
     size_t extendsize;	/* Amount to extend heap if no fit */
@@ -185,15 +287,118 @@ void *mm_malloc(size_t size)
         asize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE);
 
     /* Search the free list for a fit */
-    if ((bp = find_fit(asize)) != NULL) {
-        place(bp, asize);
+    PROFILE(MM_PROF_FIND_FIT, bp = find_fit(mm, asize));
+    if (bp != NULL) {
+        PROFILE(MM_PROF_PLACE, place(bp, asize));
         return bp;
     }
 
     /* No fit found. Get more memory and place the block */
     extendsize = MAX(asize,CHUNKSIZE);
-    if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
+    PROFILE(MM_PROF_EXTEND, bp = extend_heap(mm, extendsize/WSIZE));
+    if (bp == NULL)
         return NULL;
-    place(bp, asize);
+    PROFILE(MM_PROF_PLACE, place(bp, asize));
     return bp;
-}
\ No newline at end of file
+}
+
+/*
+ * mm_inst_heap_stats - Walk the heap block by block and count its free
+ * and allocated blocks. Runs in time linear in the number of blocks, so
+ * it is for reporting, not for the allocation path.
+ */
+void mm_inst_heap_stats(mm_inst_t *mm, mm_heap_stats_t *st)
+{
+    char *bp;
+    size_t size;
+
+    memset(st, 0, sizeof(*st));
+    st->heap_size = mem_ctx_heapsize(mm->mem);
+    for (bp = NEXT_BLKP(mm->heap_listp); (size = GET_SIZE(HDRP(bp))) > 0;
+         bp = NEXT_BLKP(bp)) {
+        if (GET_ALLOC(HDRP(bp))) {
+            st->alloc_blocks++;
+            continue;
+        }
+        st->free_blocks++;
+        st->free_bytes += size;
+        if (size > st->largest_free)
+            st->largest_free = size;
+    }
+}
+
+/*
+ * mm_inst_search_stats - What an instance's searches and coalesces have
+ * cost since it was initialized
+ */
+void mm_inst_search_stats(mm_inst_t *mm, mm_search_t *st)
+{
+    *st = mm->search;
+}
+
+/*
+ * mm_malloc - Allocate from the default instance
+ */
+void *mm_malloc(size_t size)
+{
+    void *p;
+
+    PROFILE(MM_PROF_MALLOC, p = mm_inst_malloc(&mm_default, size));
+    return p;
+}
+
+/*
+ * mm_free - Free a block of the default instance
+ */
+void mm_free(void *ptr)
+{
+    PROFILE(MM_PROF_FREE, mm_inst_free(&mm_default, ptr));
+}
+
+/*
+ * mm_heap_stats - Walk the heap of the default instance
+ */
+void mm_heap_stats(mm_heap_stats_t *st)
+{
+    mm_inst_heap_stats(&mm_default, st);
+}
+
+/*
+ * mm_search_stats - The search costs of the default instance
+ */
+void mm_search_stats(mm_search_t *st)
+{
+    mm_inst_search_stats(&mm_default, st);
+}
+
+#ifdef MM_PROFILE
+/*
+ * mm_profile_name - The name of a phase, for reports
+ */
+char *mm_profile_name(int phase)
+{
+    static char *names[MM_PROF_PHASES] = {
+        "find_fit", "place", "coalesce", "extend_heap", "mm_malloc", "mm_free"
+    };
+
+    return phase >= 0 && phase < MM_PROF_PHASES ? names[phase] : "?";
+}
+
+/*
+ * mm_profile_reset - Zero the phase times
+ */
+void mm_profile_reset(void)
+{
+    memset(&mm_prof, 0, sizeof(mm_prof));
+}
+
+/*
+ * mm_profile_dump - Copy out the phase times since the last reset, and
+ * start counting again from zero
+ */
+void mm_profile_dump(mm_profile_t *prof)
+{
+    *prof = mm_prof;
+    mm_profile_reset();
+}
+#endif
@@ -1,6 +1,80 @@
+#ifndef __MM_H_
+#define __MM_H_
+
 #include <stdio.h>
+#include <stdint.h>
+#include "memlib.h"
+
+#define MM_SEARCH_BUCKETS 16
+
+/* How hard an instance has had to work since mm_inst_init */
+typedef struct {
+    uint64_t searches;       /* find_fit calls */
+    uint64_t examined;       /* blocks they examined, in all */
+    uint64_t max_examined;   /* most blocks one of them examined */
+    uint64_t hist[MM_SEARCH_BUCKETS]; /* searches that examined 0, 1, 2-3,
+                                         4-7, ... blocks; the last bucket
+                                         holds every longer one too */
+    uint64_t coalesces;      /* coalesce calls */
+    uint64_t merges[3];      /* of those, how many merged 0, 1 and 2
+                                neighbors */
+} mm_search_t;
+
+/* An allocator instance, bound to the simulated heap it manages */
+typedef struct {
+    mem_ctx_t *mem;     /* heap this instance allocates from */
+    char *heap_listp;   /* points to the prologue block */
+    mm_search_t search; /* counted on every call; cheap enough to leave on */
+} mm_inst_t;
+
+extern int mm_inst_init (mm_inst_t *mm, mem_ctx_t *mem);
+extern void *mm_inst_malloc (mm_inst_t *mm, size_t size);
+extern void mm_inst_free (mm_inst_t *mm, void *ptr);
+
+/* What a walk over every block of an instance's heap finds */
+typedef struct {
+    size_t heap_size;    /* bytes in the heap */
+    size_t free_bytes;   /* bytes in free blocks, headers included */
+    size_t largest_free; /* size of the largest free block */
+    size_t free_blocks;  /* number of free blocks */
+    size_t alloc_blocks; /* number of allocated blocks */
+} mm_heap_stats_t;
+
+extern void mm_inst_heap_stats (mm_inst_t *mm, mm_heap_stats_t *st);
+extern void mm_inst_search_stats (mm_inst_t *mm, mm_search_t *st);
+
+/* Compatibility API on a default instance bound to mem_default_ctx() */
 
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
-static void mm_coalesce(void *ptr);
+extern void mm_heap_stats (mm_heap_stats_t *st);
+extern void mm_search_stats (mm_search_t *st);
+
+#ifdef MM_PROFILE
+/*
+ * Built with -DMM_PROFILE, mm.c times its internal phases with the
+ * cycle counter. The times are inclusive: extend_heap's include the
+ * coalesce it ends with, and MM_PROF_MALLOC and MM_PROF_FREE cover
+ * whole calls, so the phases can be read as shares of them. Without
+ * the flag none of this exists and mm.c is timed as it is.
+ */
+#define MM_PROF_FIND_FIT 0
+#define MM_PROF_PLACE    1
+#define MM_PROF_COALESCE 2
+#define MM_PROF_EXTEND   3
+#define MM_PROF_MALLOC   4
+#define MM_PROF_FREE     5
+#define MM_PROF_PHASES   6
+
+typedef struct {
+    uint64_t calls[MM_PROF_PHASES];   /* times each phase was entered */
+    uint64_t cycles[MM_PROF_PHASES];  /* counter ticks spent in it */
+} mm_profile_t;
+
+extern char *mm_profile_name (int phase);
+extern void mm_profile_reset (void);
+extern void mm_profile_dump (mm_profile_t *prof);
+#endif
+
+#endif /* __MM_H_ */
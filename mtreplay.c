@@ -0,0 +1,239 @@
+/*
+ * mtreplay.c - Replay a multi-threaded trace on several pthreads
+ *
+ * Ordering across workers uses one counter per block id: the op that
+ * is the k-th on its id waits until the counter reaches k, and bumps
+ * it when done. A worker only ever waits on ops that come earlier in
+ * the trace, so the earliest unfinished op can always go ahead and
+ * the replay cannot deadlock. Waiting workers yield the CPU rather
+ * than spin, since there may be more workers than CPUs.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "mtreplay.h"
+
+#define LOAD_OPS (1<<16) /* ops decoded per trace_read call */
+
+/* What each worker thread needs */
+typedef struct {
+    mt_trace_t *trace;
+    mt_alloc_t *alloc;
+    int *mine;           /* indices of this worker's ops, in order */
+    int count;           /* how many */
+    int *done;           /* ops finished on each id */
+    char **blocks;       /* block of each live id */
+    size_t *sizes;       /* its payload size */
+    pthread_barrier_t *start;
+    double begin, end;   /* when this worker started and finished */
+} worker_t;
+
+/*
+ * mt_error - Report an error and exit
+ */
+static void mt_error(char *msg)
+{
+    printf("%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+/*
+ * now_secs - Read the monotonic clock
+ */
+static double now_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * mt_load - Read the whole trace at path and number each op among the
+ *     ops on its id
+ */
+mt_trace_t *mt_load(char *path)
+{
+    trace_reader_t *r;
+    trace_hdr_t hdr;
+    mt_trace_t *t;
+    int *count, i, n, k;
+
+    if ((t = (mt_trace_t *)calloc(1, sizeof(mt_trace_t))) == NULL)
+	mt_error("calloc failed in mt_load");
+    r = trace_open(path, &hdr);
+    t->num_ops = hdr.num_ops;
+    t->num_ids = hdr.num_ids;
+    t->ops = (traceop_t *)malloc((t->num_ops + 1) * sizeof(traceop_t));
+    t->seq = (int *)malloc((t->num_ops + 1) * sizeof(int));
+    count = (int *)calloc(t->num_ids + 1, sizeof(int));
+    if (t->ops == NULL || t->seq == NULL || count == NULL)
+	mt_error("malloc failed in mt_load");
+
+    for (k = 0; (n = trace_read(r, t->ops + k, LOAD_OPS)) > 0; k += n)
+	;
+    trace_close(r);
+
+    t->num_threads = 1;
+    for (i = 0; i < t->num_ops; i++) {
+	t->seq[i] = count[t->ops[i].index]++;
+	if (t->ops[i].thread >= t->num_threads)
+	    t->num_threads = t->ops[i].thread + 1;
+    }
+    free(count);
+    return t;
+}
+
+/*
+ * mt_free - Release a loaded trace
+ */
+void mt_free(mt_trace_t *t)
+{
+    free(t->ops);
+    free(t->seq);
+    free(t);
+}
+
+/*
+ * run_op - Make one request, once the requests before it on its id
+ *     have been made
+ */
+static void run_op(worker_t *w, int i)
+{
+    traceop_t *op = &w->trace->ops[i];
+    int id = op->index, seq = w->trace->seq[i];
+    char *p;
+
+    while (__atomic_load_n(&w->done[id], __ATOMIC_ACQUIRE) != seq)
+	sched_yield();
+
+    switch (op->type) {
+    case ALLOC:
+	if ((p = w->alloc->malloc(op->size)) == NULL) {
+	    printf("malloc failed in multi-threaded replay\n");
+	    exit(1);
+	}
+	w->blocks[id] = p;
+	w->sizes[id] = op->size;
+	break;
+    case REALLOC:
+	if (w->alloc->realloc != NULL)
+	    p = w->alloc->realloc(w->blocks[id], op->size);
+	else if ((p = w->alloc->malloc(op->size)) != NULL) {
+	    memcpy(p, w->blocks[id],
+		   w->sizes[id] < op->size ? w->sizes[id] : op->size);
+	    w->alloc->free(w->blocks[id]);
+	}
+	if (p == NULL) {
+	    printf("realloc failed in multi-threaded replay\n");
+	    exit(1);
+	}
+	w->blocks[id] = p;
+	w->sizes[id] = op->size;
+	break;
+    case FREE:
+	w->alloc->free(w->blocks[id]);
+	w->blocks[id] = NULL;
+	break;
+    }
+    __atomic_store_n(&w->done[id], seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * worker - Body of a worker thread: wait for the others, then replay
+ *     its share of the ops in trace order
+ */
+static void *worker(void *arg)
+{
+    worker_t *w = (worker_t *)arg;
+    int i;
+
+    pthread_barrier_wait(w->start);
+    w->begin = now_secs();
+    for (i = 0; i < w->count; i++)
+	run_op(w, w->mine[i]);
+    w->end = now_secs();
+    return NULL;
+}
+
+/*
+ * mt_replay - Replay t once on the given number of workers
+ */
+void mt_replay(mt_trace_t *t, int workers, mt_alloc_t *a, mt_result_t *r)
+{
+    worker_t w[MT_MAX_WORKERS];
+    pthread_t tid[MT_MAX_WORKERS];
+    pthread_barrier_t start;
+    int *done, *mine, i, k;
+    char **blocks;
+    size_t *sizes;
+    double begin, end;
+
+    if (workers > MT_MAX_WORKERS)
+	workers = MT_MAX_WORKERS;
+    done = (int *)calloc(t->num_ids + 1, sizeof(int));
+    blocks = (char **)calloc(t->num_ids + 1, sizeof(char *));
+    sizes = (size_t *)calloc(t->num_ids + 1, sizeof(size_t));
+    mine = (int *)malloc((t->num_ops + 1) * sizeof(int));
+    if (done == NULL || blocks == NULL || sizes == NULL || mine == NULL)
+	mt_error("malloc failed in mt_replay");
+
+    /* Deal the ops out to the workers, each worker's in one run of mine */
+    memset(w, 0, sizeof(w));
+    for (i = 0; i < t->num_ops; i++)
+	w[t->ops[i].thread % workers].count++;
+    for (k = 0, i = 0; k < workers; i += w[k++].count)
+	w[k].mine = mine + i;
+    for (k = 0; k < workers; k++)
+	w[k].count = 0;
+    for (i = 0; i < t->num_ops; i++) {
+	k = t->ops[i].thread % workers;
+	w[k].mine[w[k].count++] = i;
+    }
+
+    if (a->reset != NULL)
+	a->reset();
+    pthread_barrier_init(&start, NULL, workers + 1);
+    for (k = 0; k < workers; k++) {
+	w[k].trace = t;
+	w[k].alloc = a;
+	w[k].done = done;
+	w[k].blocks = blocks;
+	w[k].sizes = sizes;
+	w[k].start = &start;
+	if ((errno = pthread_create(&tid[k], NULL, worker, &w[k])) != 0)
+	    mt_error("pthread_create failed in mt_replay");
+    }
+    pthread_barrier_wait(&start);
+    for (k = 0; k < workers; k++)
+	pthread_join(tid[k], NULL);
+    pthread_barrier_destroy(&start);
+
+    /* The workers' own clocks, since this thread may not run first */
+    r->workers = workers;
+    begin = w[0].begin;
+    end = w[0].end;
+    for (k = 0; k < workers; k++) {
+	r->ops[k] = w[k].count;
+	r->worker_secs[k] = w[k].end - w[k].begin;
+	begin = w[k].begin < begin ? w[k].begin : begin;
+	end = w[k].end > end ? w[k].end : end;
+    }
+    r->secs = end - begin;
+
+    /* Free whatever the trace left allocated, unless reset will */
+    if (a->reset == NULL)
+	for (i = 0; i < t->num_ids; i++)
+	    if (blocks[i] != NULL)
+		a->free(blocks[i]);
+
+    free(done);
+    free(blocks);
+    free(sizes);
+    free(mine);
+}
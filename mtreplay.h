@@ -0,0 +1,48 @@
+#ifndef __MTREPLAY_H_
+#define __MTREPLAY_H_
+
+/*
+ * mtreplay.h - Replay a multi-threaded trace on several pthreads
+ *
+ * Each trace thread's requests are replayed in order by one worker
+ * thread; with fewer workers than trace threads, trace thread t goes to
+ * worker t % workers. A request on a block waits until every earlier
+ * request on the same block id has been made, whichever worker made
+ * it, so a block is never freed before it is allocated.
+ */
+#include "trace.h"
+
+#define MT_MAX_WORKERS 64
+
+/* A whole trace, loaded for replay */
+typedef struct {
+    traceop_t *ops;      /* every op, in trace order */
+    int *seq;            /* how many earlier ops there are on each op's id */
+    int num_ops;
+    int num_ids;
+    int num_threads;     /* 1 + the highest thread number */
+} mt_trace_t;
+
+/* The allocator the workers call; it must be thread-safe */
+typedef struct {
+    void (*reset)(void);                   /* new, empty heap; or NULL */
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size); /* or NULL to emulate it */
+} mt_alloc_t;
+
+/* What one replay measured */
+typedef struct {
+    int workers;
+    double secs;                       /* first start to last finish */
+    double ops[MT_MAX_WORKERS];        /* ops each worker replayed... */
+    double worker_secs[MT_MAX_WORKERS];/* ... and how long it took */
+} mt_result_t;
+
+mt_trace_t *mt_load(char *path);
+void mt_free(mt_trace_t *t);
+
+/* Replay t on workers threads (at most MT_MAX_WORKERS) through a */
+void mt_replay(mt_trace_t *t, int workers, mt_alloc_t *a, mt_result_t *r);
+
+#endif /* __MTREPLAY_H_ */
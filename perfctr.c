@@ -0,0 +1,148 @@
+/*
+ * perfctr.c - Per-thread event counters read through perf_event_open
+ *
+ * Each event gets its own fd rather than joining a group, so one event
+ * the PMU doesn't support (dTLB misses on some hybrid cores, say) only
+ * costs its own column. Counts are scaled up by enabled/running time
+ * in case the kernel had to multiplex them.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perfctr.h"
+
+#define CACHE_MISS(c) \
+    ((c) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static struct {
+    uint32_t type;
+    uint64_t config;
+    char *name;
+} hw_events[PC_EVENTS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,         "cyc"    },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,       "ins"    },
+    { PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D),  "L1D"  },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,       "LLC"    },
+    { PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB), "dTLB" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,      "br-miss"},
+}, sw_events[PC_EVENTS] = {
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK,         "ns"     },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS,        "faults" },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES,   "csw"    },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS,     "migr"   },
+    { 0, 0, NULL }, { 0, 0, NULL },
+};
+
+/*
+ * open_event - Open a disabled, user-space-only counter for the
+ *     calling thread; returns the fd or -1
+ */
+static int open_event(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = (type != PERF_TYPE_SOFTWARE);
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	               PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+ * pc_open - Open the hardware counters if we can get cycles, else the
+ *     software ones
+ */
+int pc_open(pc_group_t *g)
+{
+    int i, n = 0;
+
+    for (i = 0; i < PC_EVENTS; i++)
+	g->fd[i] = -1;
+    g->software = 0;
+    for (i = 0; i < PC_EVENTS; i++) {
+	if ((g->fd[i] = open_event(hw_events[i].type, hw_events[i].config)) >= 0)
+	    n++;
+	else if (i == PC_CYCLES)
+	    break;
+    }
+    if (g->fd[PC_CYCLES] >= 0)
+	return n;
+
+    g->software = 1;
+    for (i = 0; i < PC_EVENTS && sw_events[i].name != NULL; i++)
+	if ((g->fd[i] = open_event(sw_events[i].type, sw_events[i].config)) >= 0)
+	    n++;
+    return n;
+}
+
+/*
+ * pc_close - Close whatever pc_open opened
+ */
+void pc_close(pc_group_t *g)
+{
+    int i;
+
+    for (i = 0; i < PC_EVENTS; i++) {
+	if (g->fd[i] >= 0)
+	    close(g->fd[i]);
+	g->fd[i] = -1;
+    }
+}
+
+/*
+ * pc_start - Zero the counters and start them
+ */
+void pc_start(pc_group_t *g)
+{
+    int i;
+
+    for (i = 0; i < PC_EVENTS; i++) {
+	if (g->fd[i] >= 0) {
+	    ioctl(g->fd[i], PERF_EVENT_IOC_RESET, 0);
+	    ioctl(g->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+    }
+}
+
+/*
+ * pc_stop - Stop the counters and store what they counted per op
+ */
+void pc_stop(pc_group_t *g, double ops, pc_counts_t *c)
+{
+    uint64_t buf[3]; /* value, time enabled, time running */
+    int i;
+
+    for (i = 0; i < PC_EVENTS; i++)
+	if (g->fd[i] >= 0)
+	    ioctl(g->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    c->mask = 0;
+    c->software = g->software;
+    for (i = 0; i < PC_EVENTS; i++) {
+	c->val[i] = 0;
+	if (g->fd[i] < 0 || read(g->fd[i], buf, sizeof(buf)) != sizeof(buf) ||
+	    buf[2] == 0)
+	    continue;
+	c->val[i] = (double)buf[0] * ((double)buf[1] / buf[2]) / ops;
+	c->mask |= 1u << i;
+    }
+}
+
+/*
+ * pc_event_name - Column label for event i of the hardware or
+ *     software set
+ */
+char *pc_event_name(int software, int i)
+{
+    return software ? sw_events[i].name : hw_events[i].name;
+}
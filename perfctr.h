@@ -0,0 +1,53 @@
+#ifndef __PERFCTR_H_
+#define __PERFCTR_H_
+
+/*
+ * perfctr.h - Per-thread event counters read through perf_event_open
+ *
+ * The hardware set counts cycles, instructions, L1D read misses, LLC
+ * misses, dTLB read misses and branch misses. If the CPU or the kernel
+ * won't give us the cycle counter (in a VM, or with a strict
+ * perf_event_paranoid), the software set is used instead.
+ */
+
+#define PC_EVENTS 6  /* most events in either set */
+
+/* Hardware events */
+#define PC_CYCLES      0
+#define PC_INSTR       1
+#define PC_L1D_MISS    2
+#define PC_LLC_MISS    3
+#define PC_DTLB_MISS   4
+#define PC_BRANCH_MISS 5
+
+/* Software fallback events */
+#define PC_TASK_CLOCK  0  /* ns on the CPU */
+#define PC_PAGE_FAULTS 1
+#define PC_CTX_SWITCH  2
+#define PC_MIGRATIONS  3
+
+/* An open set of counters */
+typedef struct {
+    int fd[PC_EVENTS];   /* one per event, or -1 if it couldn't be opened */
+    int software;        /* using the software set? */
+} pc_group_t;
+
+/* What one measurement counted, per op */
+typedef struct {
+    double val[PC_EVENTS];
+    unsigned mask;       /* bit i is set if val[i] was counted */
+    int software;        /* from the software set? */
+} pc_counts_t;
+
+/* Open the counters for the calling thread; returns the number opened */
+int pc_open(pc_group_t *g);
+void pc_close(pc_group_t *g);
+
+/* Zero and start the counters, then stop them and divide by ops */
+void pc_start(pc_group_t *g);
+void pc_stop(pc_group_t *g, double ops, pc_counts_t *c);
+
+/* Column label for event i of a set, or NULL if the set has no event i */
+char *pc_event_name(int software, int i);
+
+#endif /* __PERFCTR_H_ */
@@ -0,0 +1,66 @@
+/*
+ * rep2bin.c - Convert malloc lab traces between the text .rep format
+ *     and the compact binary format described in trace.c
+ *
+ * usage: rep2bin [-t] <infile> <outfile>
+ *
+ * The input may be in either format. The output is binary, or text
+ * with -t.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define CHUNK_OPS 65536 /* ops converted per trace_read call */
+
+int verbose = 0;        /* read by trace.c */
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: rep2bin [-t] <infile> <outfile>\n");
+    fprintf(stderr, "\t-t   Write the text .rep format instead of binary.\n");
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, n;
+    int format = TRACE_BINARY;
+    trace_hdr_t hdr;
+    trace_reader_t *r;
+    trace_writer_t *w;
+    traceop_t *ops;
+
+    while ((c = getopt(argc, argv, "th")) != EOF) {
+	switch (c) {
+	case 't':
+	    format = TRACE_TEXT;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (argc - optind != 2) {
+	usage();
+	exit(1);
+    }
+
+    if ((ops = (traceop_t *)malloc(CHUNK_OPS * sizeof(traceop_t))) == NULL) {
+	perror("rep2bin: malloc");
+	exit(1);
+    }
+    r = trace_open(argv[optind], &hdr);
+    w = trace_create(argv[optind+1], &hdr, format);
+    while ((n = trace_read(r, ops, CHUNK_OPS)) > 0)
+	for (i = 0; i < n; i++)
+	    trace_write(w, &ops[i]);
+    trace_finish(w);
+    trace_close(r);
+    free(ops);
+    exit(0);
+}
@@ -0,0 +1,807 @@
+/*
+ * trace.c - Reading and writing malloc lab trace files
+ *
+ * A text trace file starts with four header integers (suggested heap
+ * size, number of ids, number of ops, weight), followed by one request
+ * per line:
+ *
+ *     a <id> <bytes>   allocate
+ *     r <id> <bytes>   reallocate
+ *     f <id>           free
+ *
+ * In a multi-threaded trace a request line may start with the number
+ * of the thread that made it, as in "3 a 17 512"; lines without one
+ * belong to thread 0.
+ *
+ * Text files are mapped into memory and scanned in place. The mapping
+ * is followed by at least one zero byte, which the scanner uses as its
+ * end-of-input sentinel instead of checking bounds on every character.
+ *
+ * A binary trace file starts with a fixed TRACE_HDR_BYTES header:
+ *
+ *     bytes  0-3   magic "MLTB"
+ *     bytes  4-7   format version
+ *     bytes  8-23  sugg_heapsize, num_ids, num_ops, weight (int32 each)
+ *     bytes 24-31  FNV-1a checksum of everything after the header
+ *
+ * followed by the ops, each as one or two LEB128 varints. The first
+ * packs the type in its low two bits above the zigzag-encoded
+ * difference between this op's id and the previous op's id; alloc and
+ * realloc ops follow it with the request size. Most ops take 2-4 bytes.
+ * Type code 3 (version 2) is a thread switch: the varint after it is
+ * the thread that makes the following requests, up to the next switch.
+ * All multi-byte header fields are little-endian. Binary files are
+ * read in TRACE_BLOCK chunks.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+#define MAXLINE 1024 /* max string size */
+
+/* Binary format */
+#define TRACE_MAGIC     "MLTB"
+#define TRACE_VERSION   2         /* 2 added thread switches */
+#define TRACE_HDR_BYTES 32
+#define TRACE_MAXOP     30        /* longest encoded op: a thread switch and
+				     two 10-byte varints */
+#define TRACE_BLOCK     (1<<20)   /* binary files are read in 1 MB blocks */
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+extern int verbose; /* -v option in mdriver.c */
+
+struct trace_reader {
+    char path[MAXLINE];       /* file being read, for error messages */
+    trace_hdr_t hdr;          /* header fields */
+    int binary;               /* binary format? */
+    int ops_read;             /* ops decoded so far */
+    int done;                 /* end of trace checked? */
+    size_t max_index;         /* highest id allocated so far */
+    int line;                 /* text: line number of *p (origin 1) */
+    const unsigned char *p;   /* next unread byte */
+    const unsigned char *end; /* binary: end of valid bytes in buf */
+    char *map;                /* text: the file mapping */
+    size_t maplen;            /* text: length of the mapping */
+    int fd;                   /* binary: the open file */
+    unsigned char *buf;       /* binary: block buffer */
+    int eof;                  /* binary: no more bytes in the file */
+    uint64_t checksum;        /* binary: running checksum of ops */
+    uint64_t expected;        /* binary: checksum from the header */
+    int prev_index;           /* binary: id of the previous op */
+    int thread;               /* binary: thread of the previous op */
+};
+
+struct trace_stream {
+    char path[MAXLINE];       /* the trace file */
+    trace_hdr_t hdr;          /* its header */
+    int window;               /* ops per window */
+    int resident;             /* whole trace decoded into ops[0]? */
+    traceop_t *ops[2];        /* the two windows */
+    int count[2];             /* ops in each window, 0 marks the end */
+    int full[2];              /* window decoded and not yet handed back? */
+    int cur;                  /* window being replayed, -1 if none */
+    int next;                 /* window to replay next */
+    double stall;             /* secs spent waiting on the decoder */
+    trace_reader_t *reader;   /* streamed: the decoding thread's reader */
+    pthread_t thread;         /* streamed: the decoding thread */
+    int running;              /* streamed: has the thread been started? */
+    int stop;                 /* streamed: asks the thread to quit */
+    pthread_mutex_t lock;     /* streamed: guards full, count and stop */
+    pthread_cond_t cond;      /* streamed: signals changes to them */
+};
+
+struct trace_writer {
+    char path[MAXLINE];       /* file being written */
+    trace_hdr_t hdr;          /* header fields */
+    int binary;               /* binary format? */
+    int ops_written;          /* ops written so far */
+    FILE *fp;                 /* the output file */
+    uint64_t checksum;        /* binary: running checksum of ops */
+    int prev_index;           /* binary: id of the previous op */
+    int thread;               /* binary: thread of the previous op */
+};
+
+/*
+ * trace_error - Report a malformed trace file and exit
+ */
+static void trace_error(trace_reader_t *r, char *msg)
+{
+    if (r->binary)
+	printf("ERROR [%s, op %d]: %s\n", r->path, r->ops_read, msg);
+    else
+	printf("ERROR [%s, line %d]: %s\n", r->path, r->line, msg);
+    exit(1);
+}
+
+/*
+ * trace_unix_error - Report a Unix-style error and exit; path names the
+ *     file involved, if any
+ */
+static void trace_unix_error(char *msg, char *path)
+{
+    if (path != NULL)
+	printf("%s %s: %s\n", msg, path, strerror(errno));
+    else
+	printf("%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+/*
+ * fnv1a - Fold len bytes at p into the running checksum h
+ */
+static uint64_t fnv1a(uint64_t h, const unsigned char *p, size_t len)
+{
+    while (len-- > 0)
+	h = (h ^ *p++) * FNV_PRIME;
+    return h;
+}
+
+/*********************
+ * Text format reader
+ *********************/
+
+/*
+ * skip_space - Advance past white space, counting newlines
+ */
+static void skip_space(trace_reader_t *r)
+{
+    const unsigned char *p = r->p;
+
+    while (*p == ' ' || (unsigned)(*p - '\t') <= '\r' - '\t') {
+	r->line += (*p == '\n');
+	p++;
+    }
+    r->p = p;
+}
+
+/*
+ * scan_uint - Parse the next unsigned decimal integer; what names the
+ *     field for error messages
+ */
+static size_t scan_uint(trace_reader_t *r, char *what)
+{
+    const unsigned char *p, *start;
+    unsigned d;
+    size_t v = 0;
+    char msg[MAXLINE];
+
+    skip_space(r);
+    start = p = r->p;
+    while ((d = *p - '0') <= 9) {
+	v = v*10 + d;
+	p++;
+    }
+    if (p == start || p - start > 19 ||
+	(*p != '\0' && *p != ' ' && (unsigned)(*p - '\t') > '\r' - '\t')) {
+	sprintf(msg, "Expected %s", what);
+	trace_error(r, msg);
+    }
+    r->p = p;
+    return v;
+}
+
+/*
+ * map_text - Map the text trace open on fd read-only, followed by at
+ *     least one zero byte
+ */
+static void map_text(trace_reader_t *r, int fd)
+{
+    struct stat st;
+    size_t pagesize = getpagesize();
+
+    if (fstat(fd, &st) < 0) {
+	trace_unix_error("Could not stat", r->path);
+    }
+
+    /* Reserve one spare zero page past the end of the file, then map
+       the file over the front of the reservation */
+    r->maplen = ((st.st_size + pagesize - 1) / pagesize + 1) * pagesize;
+    r->map = mmap(NULL, r->maplen, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+		  -1, 0);
+    if (r->map == MAP_FAILED ||
+	(st.st_size > 0 &&
+	 mmap(r->map, st.st_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0)
+	 == MAP_FAILED)) {
+	trace_unix_error("Could not map", r->path);
+    }
+    madvise(r->map, st.st_size, MADV_SEQUENTIAL);
+
+    r->p = (unsigned char *)r->map;
+    r->line = 1;
+    r->hdr.sugg_heapsize = scan_uint(r, "suggested heap size"); /* not used */
+    r->hdr.num_ids = scan_uint(r, "number of ids");
+    r->hdr.num_ops = scan_uint(r, "number of ops");
+    r->hdr.weight = scan_uint(r, "weight");                     /* not used */
+}
+
+/*
+ * read_text_op - Decode the next request line into *op, or return 0 at
+ *     the end of the file
+ */
+static int read_text_op(trace_reader_t *r, traceop_t *op)
+{
+    unsigned char type;
+    char msg[MAXLINE];
+
+    skip_space(r);
+    if ((type = *r->p) == '\0')
+	return 0;
+
+    /* an optional thread number comes before the type */
+    op->thread = 0;
+    if ((unsigned)(type - '0') <= 9) {
+	op->thread = scan_uint(r, "thread");
+	skip_space(r);
+	type = *r->p;
+    }
+
+    /* the request type is the first character of a word */
+    while (*r->p > ' ')
+	r->p++;
+
+    switch (type) {
+    case 'a':
+	op->type = ALLOC;
+	break;
+    case 'r':
+	op->type = REALLOC;
+	break;
+    case 'f':
+	op->type = FREE;
+	break;
+    default:
+	sprintf(msg, "Bogus type character (%c)", type);
+	trace_error(r, msg);
+    }
+
+    op->index = scan_uint(r, "block id");
+    op->size = (type != 'f') ? scan_uint(r, "request size") : 0;
+    return 1;
+}
+
+/***********************
+ * Binary format reader
+ ***********************/
+
+/*
+ * get32/put32 - Little-endian 32-bit header fields
+ */
+static uint32_t get32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put32(unsigned char *p, uint32_t v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+/*
+ * refill - Move the unread tail of the block buffer to the front and
+ *     top the buffer up from the file
+ */
+static void refill(trace_reader_t *r)
+{
+    size_t left = r->end - r->p;
+    ssize_t n;
+
+    memmove(r->buf, r->p, left);
+    r->p = r->buf;
+    r->end = r->buf + left;
+    while (!r->eof && r->end < r->buf + TRACE_BLOCK) {
+	if ((n = read(r->fd, (void *)r->end, r->buf + TRACE_BLOCK - r->end)) < 0) {
+	    trace_unix_error("Could not read", r->path);
+	}
+	if (n == 0)
+	    r->eof = 1;
+	r->checksum = fnv1a(r->checksum, r->end, n);
+	r->end += n;
+    }
+}
+
+/*
+ * get_varint - Decode one LEB128 varint
+ */
+static uint64_t get_varint(trace_reader_t *r)
+{
+    uint64_t v = 0;
+    int shift = 0;
+
+    do {
+	if (r->p == r->end || shift > 63)
+	    trace_error(r, "Truncated or corrupt op");
+	v |= (uint64_t)(*r->p & 0x7f) << shift;
+	shift += 7;
+    } while (*r->p++ & 0x80);
+    return v;
+}
+
+/*
+ * read_bin_op - Decode the next op into *op, or return 0 at the end of
+ *     the file
+ */
+static int read_bin_op(trace_reader_t *r, traceop_t *op)
+{
+    uint64_t v;
+    int64_t delta;
+
+    if (r->end - r->p < TRACE_MAXOP && !r->eof)
+	refill(r);
+    if (r->p == r->end)
+	return 0;
+
+    /* type in the low two bits, then the zigzag-encoded id delta;
+       thread switches come first */
+    while (((v = get_varint(r)) & 3) == 3) {
+	if ((v >> 2) > INT32_MAX)
+	    trace_error(r, "Bogus thread number");
+	r->thread = v >> 2;
+    }
+    op->thread = r->thread;
+    delta = (int64_t)(v >> 3) ^ -(int64_t)((v >> 2) & 1);
+    switch (v & 3) {
+    case 0:
+	op->type = ALLOC;
+	break;
+    case 1:
+	op->type = FREE;
+	break;
+    default:
+	op->type = REALLOC;
+	break;
+    }
+    op->index = r->prev_index + delta;
+    r->prev_index = op->index;
+    op->size = (op->type != FREE) ? get_varint(r) : 0;
+    return 1;
+}
+
+/*
+ * open_bin - Read the header of the binary trace open on fd
+ */
+static void open_bin(trace_reader_t *r, int fd)
+{
+    unsigned char hdr[TRACE_HDR_BYTES];
+
+    if (read(fd, hdr, TRACE_HDR_BYTES) != TRACE_HDR_BYTES)
+	trace_error(r, "Truncated header");
+    if (get32(hdr + 4) < 1 || get32(hdr + 4) > TRACE_VERSION)
+	trace_error(r, "Unsupported binary trace version");
+    r->hdr.sugg_heapsize = get32(hdr + 8);
+    r->hdr.num_ids = get32(hdr + 12);
+    r->hdr.num_ops = get32(hdr + 16);
+    r->hdr.weight = get32(hdr + 20);
+    r->expected = get32(hdr + 24) | ((uint64_t)get32(hdr + 28) << 32);
+    if (r->hdr.num_ids < 0 || r->hdr.num_ops < 0)
+	trace_error(r, "Corrupt header");
+
+    r->fd = fd;
+    if ((r->buf = malloc(TRACE_BLOCK)) == NULL)
+	trace_unix_error("malloc failed in trace_open", NULL);
+    r->p = r->end = r->buf;
+    r->checksum = FNV_OFFSET;
+}
+
+/*****************************
+ * Format-independent reading
+ *****************************/
+
+/*
+ * trace_open - Open the trace at path, detect its format and read its
+ *     header into *hdr
+ */
+trace_reader_t *trace_open(char *path, trace_hdr_t *hdr)
+{
+    trace_reader_t *r;
+    char magic[4];
+    int fd;
+
+    if ((r = (trace_reader_t *)calloc(1, sizeof(trace_reader_t))) == NULL)
+	trace_unix_error("calloc failed in trace_open", NULL);
+    strncpy(r->path, path, MAXLINE-1);
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+	trace_unix_error("Could not open", path);
+    }
+    r->binary = (pread(fd, magic, 4, 0) == 4 && !memcmp(magic, TRACE_MAGIC, 4));
+    if (r->binary)
+	open_bin(r, fd);
+    else {
+	map_text(r, fd);
+	close(fd);
+    }
+
+    *hdr = r->hdr;
+    return r;
+}
+
+/*
+ * trace_check_end - Having read all num_ops ops, make sure the file
+ *     ends there and agrees with its header
+ */
+static void trace_check_end(trace_reader_t *r)
+{
+    traceop_t op;
+    char msg[MAXLINE];
+
+    if (r->binary ? read_bin_op(r, &op) : read_text_op(r, &op)) {
+	sprintf(msg, "More requests than the %d in the header", r->hdr.num_ops);
+	trace_error(r, msg);
+    }
+    if (r->binary && r->checksum != r->expected)
+	trace_error(r, "Checksum mismatch");
+    if (r->hdr.num_ids > 0 && r->max_index != (size_t)r->hdr.num_ids - 1) {
+	sprintf(msg, "Highest allocated id is %zu, but the header says %d ids",
+		r->max_index, r->hdr.num_ids);
+	trace_error(r, msg);
+    }
+}
+
+/*
+ * trace_read - Decode up to max ops into ops; returns the number
+ *     decoded, 0 once the whole trace has been read
+ */
+int trace_read(trace_reader_t *r, traceop_t *ops, int max)
+{
+    int n, left = r->hdr.num_ops - r->ops_read;
+    char msg[MAXLINE];
+
+    if (max > left)
+	max = left;
+    for (n = 0; n < max; n++) {
+	if (!(r->binary ? read_bin_op(r, &ops[n]) : read_text_op(r, &ops[n]))) {
+	    sprintf(msg, "Found %d requests, but the header says %d",
+		    r->ops_read, r->hdr.num_ops);
+	    trace_error(r, msg);
+	}
+	if (ops[n].index < 0 || ops[n].index >= r->hdr.num_ids) {
+	    sprintf(msg, "Block id %d out of range (%d ids in the header)",
+		    ops[n].index, r->hdr.num_ids);
+	    trace_error(r, msg);
+	}
+	if (ops[n].type != FREE && (size_t)ops[n].index > r->max_index)
+	    r->max_index = ops[n].index;
+	r->ops_read++;
+    }
+    if (r->ops_read == r->hdr.num_ops && !r->done) {
+	r->done = 1;
+	trace_check_end(r);
+    }
+    return n;
+}
+
+/*
+ * trace_close - Release a reader
+ */
+void trace_close(trace_reader_t *r)
+{
+    if (r->binary) {
+	close(r->fd);
+	free(r->buf);
+    }
+    else
+	munmap(r->map, r->maplen);
+    free(r);
+}
+
+/*******************
+ * Windowed streams
+ *******************/
+
+/*
+ * trace_stream_decode - Body of the decoding thread: fill whichever
+ *     window the replay side is not using, one after the other, until a
+ *     window comes up empty at the end of the trace
+ */
+static void *trace_stream_decode(void *arg)
+{
+    trace_stream_t *s = (trace_stream_t *)arg;
+    int w = 0, n;
+
+    do {
+	pthread_mutex_lock(&s->lock);
+	while (s->full[w] && !s->stop)
+	    pthread_cond_wait(&s->cond, &s->lock);
+	pthread_mutex_unlock(&s->lock);
+	if (s->stop)
+	    break;
+
+	n = trace_read(s->reader, s->ops[w], s->window);
+
+	pthread_mutex_lock(&s->lock);
+	s->count[w] = n;
+	s->full[w] = 1;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	w ^= 1;
+    } while (n > 0);
+    return NULL;
+}
+
+/*
+ * trace_stream_stop - Stop the decoding thread, if any, and close the
+ *     reader it was using
+ */
+static void trace_stream_stop(trace_stream_t *s)
+{
+    if (!s->running)
+	return;
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+    trace_close(s->reader);
+    s->running = 0;
+}
+
+/*
+ * now_secs - Read the monotonic clock
+ */
+static double now_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * trace_stream_open - Open tracedir/filename for replay in windows of
+ *     up to window ops. A trace that fits in one window is decoded
+ *     here, once, and stays resident.
+ */
+trace_stream_t *trace_stream_open(char *tracedir, char *filename, int window)
+{
+    trace_stream_t *s;
+    trace_reader_t *r;
+
+    if (verbose > 1)
+	printf("Reading tracefile: %s\n", filename);
+
+    if ((s = (trace_stream_t *)calloc(1, sizeof(trace_stream_t))) == NULL)
+	trace_unix_error("calloc failed in trace_stream_open", NULL);
+    strcpy(s->path, tracedir);
+    strcat(s->path, filename);
+
+    r = trace_open(s->path, &s->hdr);
+    s->resident = (s->hdr.num_ops <= window);
+    s->window = s->resident ? (s->hdr.num_ops > 0 ? s->hdr.num_ops : 1) : window;
+    if ((s->ops[0] = (traceop_t *)malloc(s->window * sizeof(traceop_t))) == NULL)
+	trace_unix_error("malloc failed in trace_stream_open", NULL);
+
+    if (s->resident) {
+	s->count[0] = trace_read(r, s->ops[0], s->window);
+	trace_close(r);
+    }
+    else {
+	trace_close(r);
+	if ((s->ops[1] = (traceop_t *)malloc(s->window * sizeof(traceop_t))) == NULL)
+	    trace_unix_error("malloc failed in trace_stream_open", NULL);
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->cond, NULL);
+    }
+    return s;
+}
+
+/*
+ * trace_stream_hdr - The header of the trace being streamed
+ */
+trace_hdr_t *trace_stream_hdr(trace_stream_t *s)
+{
+    return &s->hdr;
+}
+
+/*
+ * trace_stream_rewind - Go back to the first op. A streamed trace is
+ *     reopened and its first windows are decoded in the background.
+ */
+void trace_stream_rewind(trace_stream_t *s)
+{
+    double start;
+    trace_hdr_t hdr;
+
+    s->cur = -1;
+    s->next = 0;
+    if (s->resident)
+	return;
+
+    start = now_secs();
+    trace_stream_stop(s);
+    s->reader = trace_open(s->path, &hdr);
+    s->full[0] = s->full[1] = 0;
+    s->stop = 0;
+    if (pthread_create(&s->thread, NULL, trace_stream_decode, s) != 0)
+	trace_unix_error("pthread_create failed in trace_stream_rewind", NULL);
+    s->running = 1;
+    s->stall += now_secs() - start;
+}
+
+/*
+ * trace_stream_next - Hand back the window the caller was replaying and
+ *     point *ops at the next one; returns its length, 0 at the end of
+ *     the trace
+ */
+int trace_stream_next(trace_stream_t *s, traceop_t **ops)
+{
+    double start;
+    int w = s->next;
+
+    if (s->resident) {
+	if (w > 0)
+	    return 0;
+	s->next = 1;
+	*ops = s->ops[0];
+	return s->count[0];
+    }
+
+    start = now_secs();
+    pthread_mutex_lock(&s->lock);
+    if (s->cur >= 0 && s->count[s->cur] > 0) {
+	s->full[s->cur] = 0;
+	pthread_cond_broadcast(&s->cond);
+    }
+    while (!s->full[w])
+	pthread_cond_wait(&s->cond, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+    s->stall += now_secs() - start;
+
+    s->cur = w;
+    if (s->count[w] > 0)
+	s->next = w ^ 1;
+    *ops = s->ops[w];
+    return s->count[w];
+}
+
+/*
+ * trace_stream_stall - Total seconds spent waiting for windows to be
+ *     decoded, including reopening the file on each rewind
+ */
+double trace_stream_stall(trace_stream_t *s)
+{
+    return s->stall;
+}
+
+/*
+ * trace_stream_close - Stop decoding and release the stream
+ */
+void trace_stream_close(trace_stream_t *s)
+{
+    if (!s->resident) {
+	trace_stream_stop(s);
+	pthread_mutex_destroy(&s->lock);
+	pthread_cond_destroy(&s->cond);
+    }
+    free(s->ops[0]);
+    free(s->ops[1]);
+    free(s);
+}
+
+/**********
+ * Writing
+ **********/
+
+/*
+ * put_varint - Append the LEB128 encoding of v at p; returns the new end
+ */
+static unsigned char *put_varint(unsigned char *p, uint64_t v)
+{
+    while (v >= 0x80) {
+	*p++ = (v & 0x7f) | 0x80;
+	v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+/*
+ * put_header - Write the binary header for w at the current position
+ */
+static void put_header(trace_writer_t *w)
+{
+    unsigned char hdr[TRACE_HDR_BYTES];
+
+    memcpy(hdr, TRACE_MAGIC, 4);
+    put32(hdr + 4, TRACE_VERSION);
+    put32(hdr + 8, w->hdr.sugg_heapsize);
+    put32(hdr + 12, w->hdr.num_ids);
+    put32(hdr + 16, w->hdr.num_ops);
+    put32(hdr + 20, w->hdr.weight);
+    put32(hdr + 24, (uint32_t)w->checksum);
+    put32(hdr + 28, (uint32_t)(w->checksum >> 32));
+    fwrite(hdr, 1, TRACE_HDR_BYTES, w->fp);
+}
+
+/*
+ * trace_create - Start writing a trace in the given format
+ */
+trace_writer_t *trace_create(char *path, trace_hdr_t *hdr, int format)
+{
+    trace_writer_t *w;
+
+    if ((w = (trace_writer_t *)calloc(1, sizeof(trace_writer_t))) == NULL)
+	trace_unix_error("calloc failed in trace_create", NULL);
+    strncpy(w->path, path, MAXLINE-1);
+    w->hdr = *hdr;
+    w->binary = (format == TRACE_BINARY);
+    if ((w->fp = fopen(path, "w")) == NULL) {
+	trace_unix_error("Could not create", path);
+    }
+    setvbuf(w->fp, NULL, _IOFBF, TRACE_BLOCK);
+
+    w->checksum = FNV_OFFSET;
+    if (w->binary)
+	put_header(w);    /* rewritten with the checksum by trace_finish */
+    else
+	fprintf(w->fp, "%d\n%d\n%d\n%d\n", hdr->sugg_heapsize, hdr->num_ids,
+		hdr->num_ops, hdr->weight);
+    return w;
+}
+
+/*
+ * trace_write - Append one op
+ */
+void trace_write(trace_writer_t *w, traceop_t *op)
+{
+    unsigned char buf[TRACE_MAXOP], *p;
+    int64_t delta;
+    static const char types[] = {'a', 'f', 'r'}; /* indexed by op type */
+
+    w->ops_written++;
+    if (!w->binary) {
+	if (op->thread != 0)
+	    fprintf(w->fp, "%d ", op->thread);
+	if (op->type == FREE)
+	    fprintf(w->fp, "f %d\n", op->index);
+	else
+	    fprintf(w->fp, "%c %d %zu\n", types[op->type], op->index, op->size);
+	return;
+    }
+
+    p = buf;
+    if (op->thread != w->thread) {
+	p = put_varint(p, ((uint64_t)op->thread << 2) | 3);
+	w->thread = op->thread;
+    }
+    delta = (int64_t)op->index - w->prev_index;
+    w->prev_index = op->index;
+    p = put_varint(p, ((uint64_t)((delta << 1) ^ (delta >> 63)) << 2) |
+		   op->type);
+    if (op->type != FREE)
+	p = put_varint(p, op->size);
+    w->checksum = fnv1a(w->checksum, buf, p - buf);
+    fwrite(buf, 1, p - buf, w->fp);
+}
+
+/*
+ * trace_finish - Complete the file and release the writer
+ */
+void trace_finish(trace_writer_t *w)
+{
+
+    if (w->ops_written != w->hdr.num_ops) {
+	printf("ERROR [%s]: wrote %d requests, but the header says %d\n",
+	       w->path, w->ops_written, w->hdr.num_ops);
+	exit(1);
+    }
+    if (w->binary) {
+	rewind(w->fp);
+	put_header(w);
+    }
+    if (fclose(w->fp) != 0) {
+	trace_unix_error("Could not write", w->path);
+    }
+    free(w);
+}
@@ -0,0 +1,74 @@
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+/*
+ * trace.h - Reading and writing malloc lab trace files
+ *
+ * Traces come in two formats, told apart by their first bytes: the
+ * original text .rep format and a compact binary format (see trace.c).
+ * Every reader accepts both.
+ */
+#include <stddef.h>
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    int index;                        /* index for free() to use later */
+    size_t size;                      /* byte size of alloc/realloc request */
+    int thread;                       /* thread that made the request */
+} traceop_t;
+
+/* The header fields shared by both trace formats */
+typedef struct {
+    int sugg_heapsize;   /* suggested heap size (unused) */
+    int num_ids;         /* number of alloc/realloc ids */
+    int num_ops;         /* number of distinct requests */
+    int weight;          /* weight for this trace (unused) */
+} trace_hdr_t;
+
+/* Output formats for trace_create */
+#define TRACE_TEXT   0
+#define TRACE_BINARY 1
+
+typedef struct trace_reader trace_reader_t;
+typedef struct trace_writer trace_writer_t;
+typedef struct trace_stream trace_stream_t;
+
+/*
+ * Streaming reader: trace_open reads the header of the trace at path
+ * into *hdr; each trace_read then decodes up to max ops and returns how
+ * many it decoded, 0 once all num_ops have been read. Malformed input
+ * is reported and exits.
+ */
+trace_reader_t *trace_open(char *path, trace_hdr_t *hdr);
+int trace_read(trace_reader_t *r, traceop_t *ops, int max);
+void trace_close(trace_reader_t *r);
+
+/*
+ * Streaming writer: trace_create starts a trace at path in format
+ * TRACE_TEXT or TRACE_BINARY with the header *hdr; exactly
+ * hdr->num_ops ops must then be written before trace_finish.
+ */
+trace_writer_t *trace_create(char *path, trace_hdr_t *hdr, int format);
+void trace_write(trace_writer_t *w, traceop_t *op);
+void trace_finish(trace_writer_t *w);
+
+/*
+ * Windowed replay: trace_stream_open opens tracedir/filename to be
+ * replayed window ops at a time. A trace of at most window ops is
+ * decoded once and kept in memory; a longer one is decoded by a
+ * background thread into two alternating windows, so the next window
+ * is ready while the current one is replayed. Each pass over the trace
+ * starts with trace_stream_rewind, then calls trace_stream_next until
+ * it returns 0; a window stays valid until the next call.
+ * trace_stream_stall adds up the time the replay side has spent
+ * waiting for the decoder, so it can be left out of measurements.
+ */
+trace_stream_t *trace_stream_open(char *tracedir, char *filename, int window);
+trace_hdr_t *trace_stream_hdr(trace_stream_t *s);
+void trace_stream_rewind(trace_stream_t *s);
+int trace_stream_next(trace_stream_t *s, traceop_t **ops);
+double trace_stream_stall(trace_stream_t *s);
+void trace_stream_close(trace_stream_t *s);
+
+#endif /* __TRACE_H_ */
@@ -0,0 +1,516 @@
+/*
+ * tracereduce.c - Shrink a trace by sampling its blocks
+ *
+ * usage: tracereduce [-t] [-k <fraction>] [-s <seed>] [-n <tries>]
+ *                    [-S <tol>] [-L <tol>] [-F <tol>] <infile> <outfile>
+ *
+ * A block id is kept with probability <fraction> (default 0.01),
+ * decided by hashing it with the seed, and a kept id keeps every one of
+ * its requests: its allocation, reallocs and free, in their original
+ * order and on their original threads. Ids are renumbered densely in
+ * order of first use. Sampling whole lifecycles rather than requests
+ * keeps the trace valid and leaves the mix of sizes and lifetimes that
+ * an allocator sees alone.
+ *
+ * How faithful the reduced trace is gets scored three ways, each a
+ * distance that is 0 when the two are the same:
+ *
+ *     sizes      Kolmogorov-Smirnov distance between the request size
+ *                distributions, in power-of-two buckets
+ *     live       mean absolute gap between the live-byte curves, each
+ *                over its own mean, at LIVE_POINTS points along the
+ *                trace
+ *     lifetimes  Kolmogorov-Smirnov distance between the distributions
+ *                of block lifetimes, each measured as a fraction of its
+ *                own trace's length, in power-of-two buckets; lifetimes
+ *                shorter than one request of the reduced trace can't be
+ *                told apart there, so they count as one bucket
+ *
+ * With a small sample the live-byte curve is the noisiest, as a few
+ * large blocks can make up much of it: even a faithful sample misses
+ * the input's curve by about the spread of a sum over the blocks it
+ * happened to keep. That spread follows from the input alone (the
+ * sizes of the blocks live at each point, how long each lives, and the
+ * fraction), so the live tolerance is -L on top of the gap it predicts,
+ * and -L bounds how much worse than a typical sample of that size one
+ * may be. Past NOISE_MAX the predicted gap is as large as the shape
+ * itself, so the live check is reported as uninformative and fails.
+ *
+ * Up to <tries> seeds (default 10) are tried in turn, stopping at the
+ * first whose scores are all within their tolerances (-S, -L, -F), and
+ * the sample that came closest is written. If even that one misses a
+ * tolerance, the exit status is 2; a larger fraction is the cure.
+ *
+ * The input is read a chunk at a time, so traces of any length can be
+ * reduced: once per seed to choose the ids and score the result, then
+ * again to write it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "trace.h"
+
+#define CHUNK_OPS   65536 /* ops read per trace_read call */
+#define LIVE_POINTS 200   /* points at which the live-byte curves meet */
+#define BUCKETS     64    /* power-of-two buckets for sizes and lifetimes */
+#define LIFE_MIN    40    /* lifetimes are bucketed down to 2^-LIFE_MIN */
+
+#define TRIES       10    /* seeds tried by default */
+
+/* Default tolerances */
+#define TOL_SIZE    0.05
+#define TOL_LIVE    0.10
+#define TOL_LIFE    0.10
+
+#define NOISE_MAX   0.5   /* expected live gap beyond which it says nothing */
+
+int verbose = 0;          /* read by trace.c */
+
+/* What the first pass learns about one of the two traces */
+typedef struct {
+    long ops;                   /* requests */
+    int ids;                    /* block ids */
+    double live;                /* live bytes now */
+    double sq;                  /* sum of the squared live sizes now */
+    double curve[LIVE_POINTS];  /* live bytes along the input trace */
+    double sqs[LIVE_POINTS];    /* squared live sizes along the input */
+    double wsq[LIVE_POINTS + 1];/* live sizes times their mean share */
+    double vsq;                 /* sum of the squared mean shares */
+    double sizes[BUCKETS];      /* request sizes */
+    double life[BUCKETS];       /* block lifetimes */
+} profile_t;
+
+/* How far a sample is from its input */
+typedef struct {
+    double size, live, life;
+} scores_t;
+
+static void reduce_error(char *msg)
+{
+    fprintf(stderr, "tracereduce: %s\n", msg);
+    exit(1);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracereduce [-t] [-k <fraction>] [-s <seed>] [-n <tries>] [-S <tol>] [-L <tol>] [-F <tol>]\n");
+    fprintf(stderr, "                   <infile> <outfile>\n");
+    fprintf(stderr, "\t-t          Write the text .rep format instead of binary.\n");
+    fprintf(stderr, "\t-k <frac>   Fraction of block ids to keep (default 0.01).\n");
+    fprintf(stderr, "\t-s <seed>   First seed for choosing the ids (default 1).\n");
+    fprintf(stderr, "\t-n <tries>  Seeds to try for a sample within the tolerances (default %d).\n", TRIES);
+    fprintf(stderr, "\t-S <tol>    Tolerance for the size distribution (default %g).\n", TOL_SIZE);
+    fprintf(stderr, "\t-L <tol>    Tolerance for the live-byte curve, beyond sampling (default %g).\n", TOL_LIVE);
+    fprintf(stderr, "\t-F <tol>    Tolerance for the lifetime distribution (default %g).\n", TOL_LIFE);
+}
+
+/*
+ * keep_id - Is id in the sample? A splitmix64 hash of the id and seed,
+ *     compared with the fraction
+ */
+static int keep_id(int id, uint64_t seed, double fraction)
+{
+    uint64_t z = (uint64_t)id + seed * 0x9E3779B97F4A7C15ULL;
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return (z >> 11) * (1.0 / 9007199254740992.0) < fraction;
+}
+
+/*
+ * bucket - The power-of-two bucket of x >= 1
+ */
+static int bucket(double x)
+{
+    int b = x < 1 ? 0 : (int)log2(x);
+
+    return b < BUCKETS ? b : BUCKETS - 1;
+}
+
+/*
+ * add_life - Record a lifetime of len requests in a trace of n
+ */
+static void add_life(profile_t *p, double len, double n)
+{
+    p->life[bucket(len / n * pow(2, LIFE_MIN))]++;
+}
+
+/*
+ * ks - Kolmogorov-Smirnov distance between two bucketed distributions,
+ *     taking the buckets up to lo as one
+ */
+static double ks(double *a, double *b, int lo)
+{
+    double na = 0, nb = 0, ca = 0, cb = 0, d = 0;
+    int i;
+
+    for (i = 0; i < BUCKETS; i++) {
+	na += a[i];
+	nb += b[i];
+    }
+    if (na == 0 || nb == 0)
+	return na == nb ? 0 : 1;
+    for (i = 0; i < BUCKETS; i++) {
+	ca += a[i] / na;
+	cb += b[i] / nb;
+	if (i >= lo && fabs(ca - cb) > d)
+	    d = fabs(ca - cb);
+    }
+    return d;
+}
+
+/*
+ * curve_mean - Mean of a live-byte curve over its points
+ */
+static double curve_mean(double *curve)
+{
+    double m = 0;
+    int i;
+
+    for (i = 0; i < LIVE_POINTS; i++)
+	m += curve[i] / LIVE_POINTS;
+    return m;
+}
+
+/*
+ * live_gap - Mean absolute gap between the live-byte curves over
+ *     their means
+ */
+static double live_gap(profile_t *in, profile_t *out)
+{
+    double d = 0, mi = curve_mean(in->curve), mo = curve_mean(out->curve);
+    int i;
+
+    if (mi == 0 || mo == 0)
+	return mi == mo ? 0 : 1;
+    for (i = 0; i < LIVE_POINTS; i++)
+	d += fabs(in->curve[i] / mi - out->curve[i] / mo) / LIVE_POINTS;
+    return d;
+}
+
+/*
+ * live_noise - The live_gap expected of a sample keeping each block
+ *     with probability fraction. A block of size s live at point i
+ *     adds s to curve i and its mean share a (s times the fraction of
+ *     the points it is live at) to the curve's mean, so curve i over
+ *     its mean, r_i = curve i / mean, moves by (s - r_i a) / mean when
+ *     the block is kept or dropped. Summed over the blocks that is a
+ *     normal error with variance (1 - fraction) / fraction times
+ *     sum (s - r_i a)^2, whose mean absolute value is sqrt(2/pi) of its
+ *     deviation. Blocks live all along move the curve and its mean
+ *     alike, and cancel.
+ */
+static double live_noise(profile_t *in, double fraction)
+{
+    double d = 0, mi = curve_mean(in->curve), r, var;
+    int i;
+
+    if (mi == 0)
+	return 0;
+    for (i = 0; i < LIVE_POINTS; i++) {
+	r = in->curve[i] / mi;
+	var = in->sqs[i] - 2 * r * in->wsq[i] + r * r * in->vsq;
+	d += sqrt(fmax(var, 0) * (1 - fraction) / fraction) / LIVE_POINTS;
+    }
+    return sqrt(2 / M_PI) * d / mi;
+}
+
+/*
+ * end_segment - Account for a block that held size bytes from point
+ *     from up to, but not including, point to
+ */
+static void end_segment(profile_t *p, double size, int from, int to)
+{
+    double a = size * (to - from) / LIVE_POINTS;
+
+    if (size == 0 || to <= from)
+	return;
+    p->wsq[from] += size * a;   /* spread over [from, to) later */
+    p->wsq[to] -= size * a;
+    p->vsq += a * a;
+}
+
+/*
+ * account - Update a profile for one request on a block of size bytes
+ *     that was size0 bytes before it
+ */
+static void account(profile_t *p, traceop_t *op, double size0, double size)
+{
+    p->ops++;
+    if (op->type != FREE)
+	p->sizes[bucket(size)]++;
+    p->live += size - size0;
+    p->sq += size * size - size0 * size0;
+}
+
+/*
+ * profile - The first pass: choose the ids to keep, numbering them in
+ *     *newid, and profile the trace before and after
+ */
+static void profile(char *path, uint64_t seed, double fraction,
+		    int *newid, profile_t *in, profile_t *out)
+{
+    trace_hdr_t hdr;
+    trace_reader_t *r;
+    traceop_t *ops, *op;
+    long *born_in, *born_out; /* request at which each id was allocated */
+    double *size;             /* each id's current size */
+    int *seg_pt;              /* first point at which it had that size */
+    int *out_life = NULL;     /* kept lifetimes, until out->ops is known */
+    long nlife = 0, max_life = 0, i;
+    int n, k, pt = 0, id;
+    double s0;
+
+    r = trace_open(path, &hdr);
+    born_in = (long *)malloc((hdr.num_ids + 1) * sizeof(long));
+    born_out = (long *)malloc((hdr.num_ids + 1) * sizeof(long));
+    size = (double *)calloc(hdr.num_ids + 1, sizeof(double));
+    seg_pt = (int *)malloc((hdr.num_ids + 1) * sizeof(int));
+    ops = (traceop_t *)malloc(CHUNK_OPS * sizeof(traceop_t));
+    if (!born_in || !born_out || !size || !seg_pt || !ops)
+	reduce_error("out of memory");
+    for (id = 0; id < hdr.num_ids; id++) {
+	newid[id] = -2;      /* not seen yet; -1 once it is left out */
+	born_in[id] = -1;    /* not live */
+	seg_pt[id] = 0;
+    }
+
+    while ((n = trace_read(r, ops, CHUNK_OPS)) > 0) {
+	for (k = 0; k < n; k++) {
+	    op = &ops[k];
+	    id = op->index;
+	    if (op->type == ALLOC) {
+		if (newid[id] == -2) {
+		    newid[id] = keep_id(id, seed, fraction) ? out->ids++ : -1;
+		    in->ids++;
+		}
+		born_in[id] = in->ops;
+		born_out[id] = out->ops;
+	    }
+	    s0 = size[id];
+	    size[id] = op->type == FREE ? 0 : op->size;
+	    if (size[id] != s0) {
+		end_segment(in, s0, seg_pt[id], pt);
+		seg_pt[id] = pt;
+	    }
+	    if (op->type == FREE && born_in[id] >= 0) {
+		add_life(in, in->ops - born_in[id], hdr.num_ops);
+		if (newid[id] >= 0) {
+		    if (nlife == max_life) {
+			max_life = max_life ? 2 * max_life : 1024;
+			if ((out_life = (int *)realloc(out_life, max_life * sizeof(int))) == NULL)
+			    reduce_error("out of memory");
+		    }
+		    out_life[nlife++] = out->ops - born_out[id];
+		}
+		born_in[id] = -1;
+	    }
+	    if (newid[id] >= 0)
+		account(out, op, s0, size[id]);
+	    account(in, op, s0, size[id]);
+
+	    /* Both curves are sampled at the same places in the input */
+	    while (pt < LIVE_POINTS &&
+		   in->ops >= (double)(pt + 1) * hdr.num_ops / LIVE_POINTS) {
+		in->curve[pt] = in->live;
+		in->sqs[pt] = in->sq;
+		out->curve[pt] = out->live;
+		pt++;
+	    }
+	}
+    }
+    trace_close(r);
+
+    /* Blocks never freed live to the end of the trace */
+    for (id = 0; id < hdr.num_ids; id++) {
+	end_segment(in, size[id], seg_pt[id], pt);
+	if (born_in[id] >= 0) {
+	    add_life(in, in->ops - born_in[id], hdr.num_ops);
+	    if (newid[id] >= 0)
+		add_life(out, out->ops - born_out[id], out->ops);
+	}
+    }
+    for (i = 0; i < nlife; i++)
+	add_life(out, out_life[i], out->ops);
+    for (k = 1; k < LIVE_POINTS; k++)
+	in->wsq[k] += in->wsq[k - 1];
+
+    free(born_in);
+    free(born_out);
+    free(size);
+    free(seg_pt);
+    free(out_life);
+    free(ops);
+}
+
+/*
+ * write_reduced - The second pass: write the kept ids' requests
+ */
+static void write_reduced(char *inpath, char *outpath, int format,
+			  int *newid, profile_t *out)
+{
+    trace_hdr_t hdr;
+    trace_reader_t *r;
+    trace_writer_t *w;
+    traceop_t *ops;
+    int n, k;
+
+    if ((ops = (traceop_t *)malloc(CHUNK_OPS * sizeof(traceop_t))) == NULL)
+	reduce_error("out of memory");
+    r = trace_open(inpath, &hdr);
+    hdr.num_ids = out->ids;
+    hdr.num_ops = out->ops;
+    w = trace_create(outpath, &hdr, format);
+    while ((n = trace_read(r, ops, CHUNK_OPS)) > 0) {
+	for (k = 0; k < n; k++) {
+	    if (newid[ops[k].index] < 0)
+		continue;
+	    ops[k].index = newid[ops[k].index];
+	    trace_write(w, &ops[k]);
+	}
+    }
+    trace_finish(w);
+    trace_close(r);
+    free(ops);
+}
+
+/*
+ * get_scores - Score a sample against its input
+ */
+static void get_scores(profile_t *in, profile_t *out, scores_t *s)
+{
+    s->size = ks(in->sizes, out->sizes, 0);
+    s->live = live_gap(in, out);
+    s->life = ks(in->life, out->life, bucket(pow(2, LIFE_MIN) / out->ops));
+}
+
+/*
+ * score - Print one score against its tolerance, plus the gap sampling
+ *     alone is expected to leave; returns 1 if it fails or, when that
+ *     gap is past NOISE_MAX, can't tell
+ */
+static int score(char *name, double d, double tol, double noise)
+{
+    if (noise > NOISE_MAX) {
+	printf("  %-10s %7.4f  (sampling alone leaves %.4f)  uninformative\n",
+	       name, d, noise);
+	return 1;
+    }
+    if (noise > 0)
+	printf("  %-10s %7.4f  (tolerance %g + %.4f from sampling)  %s\n",
+	       name, d, tol, noise, d <= tol + noise ? "ok" : "FAIL");
+    else
+	printf("  %-10s %7.4f  (tolerance %g)  %s\n", name, d, tol,
+	       d <= tol ? "ok" : "FAIL");
+    return d > tol + noise;
+}
+
+int main(int argc, char **argv)
+{
+    int c, t, format = TRACE_BINARY, *newid, *trial, *tmp, failed = 0;
+    int tries = TRIES;
+    double fraction = 0.01, worst, best_worst = 0, noise = 0;
+    double tol_size = TOL_SIZE, tol_live = TOL_LIVE, tol_life = TOL_LIFE;
+    uint64_t seed = 1, best_seed = 0;
+    trace_hdr_t hdr;
+    trace_reader_t *r;
+    profile_t *in, *out, *best;
+    scores_t sc, best_sc = {0, 0, 0};
+
+    while ((c = getopt(argc, argv, "tk:s:n:S:L:F:h")) != EOF) {
+	switch (c) {
+	case 't':
+	    format = TRACE_TEXT;
+	    break;
+	case 'k':
+	    if ((fraction = atof(optarg)) <= 0 || fraction > 1)
+		reduce_error("the fraction to keep must be in (0, 1]");
+	    break;
+	case 's':
+	    seed = strtoull(optarg, NULL, 0);
+	    break;
+	case 'n':
+	    if ((tries = atoi(optarg)) < 1)
+		reduce_error("the number of tries must be at least 1");
+	    break;
+	case 'S':
+	    tol_size = atof(optarg);
+	    break;
+	case 'L':
+	    tol_live = atof(optarg);
+	    break;
+	case 'F':
+	    tol_life = atof(optarg);
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (argc - optind != 2) {
+	usage();
+	exit(1);
+    }
+
+    r = trace_open(argv[optind], &hdr);
+    trace_close(r);
+    in = (profile_t *)malloc(sizeof(profile_t));
+    out = (profile_t *)malloc(sizeof(profile_t));
+    best = (profile_t *)malloc(sizeof(profile_t));
+    newid = (int *)malloc((hdr.num_ids + 1) * sizeof(int));
+    trial = (int *)malloc((hdr.num_ids + 1) * sizeof(int));
+    if (!in || !out || !best || !newid || !trial)
+	reduce_error("out of memory");
+
+    /* Keep the sample that is closest, relative to the tolerances */
+    best->ops = 0;
+    for (t = 0; t < tries; t++) {
+	memset(in, 0, sizeof(profile_t));
+	memset(out, 0, sizeof(profile_t));
+	profile(argv[optind], seed + t, fraction, trial, in, out);
+	if (out->ops == 0)
+	    continue;
+	get_scores(in, out, &sc);
+	noise = live_noise(in, fraction);
+	worst = fmax(sc.size / tol_size, sc.life / tol_life);
+	if (noise <= NOISE_MAX)
+	    worst = fmax(worst, sc.live / (tol_live + noise));
+	if (best->ops == 0 || worst < best_worst) {
+	    tmp = newid;
+	    newid = trial;
+	    trial = tmp;
+	    *best = *out;
+	    best_sc = sc;
+	    best_seed = seed + t;
+	    best_worst = worst;
+	}
+	if (worst <= 1)
+	    break;
+    }
+    if (best->ops == 0)
+	reduce_error("no ids were kept; use a larger fraction");
+    write_reduced(argv[optind], argv[optind+1], format, newid, best);
+
+    printf("%ld ops on %d ids -> %ld ops on %d ids (%.1fx shorter), "
+	   "seed %lu of %d tried\n", in->ops, in->ids, best->ops, best->ids,
+	   (double)in->ops / best->ops, (unsigned long)best_seed, 
+	   t < tries ? t + 1 : tries);
+    failed |= score("sizes", best_sc.size, tol_size, 0);
+    failed |= score("live", best_sc.live, tol_live, noise);
+    failed |= score("lifetimes", best_sc.life, tol_life, 0);
+
+    free(in);
+    free(out);
+    free(best);
+    free(newid);
+    free(trial);
+    exit(failed ? 2 : 0);
+}